@@ -7,6 +7,10 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <algorithm>            // ranges::find()
+#include <atomic>
+#include <memory>               // make_shared(), make_unique(), unique_ptr<>
+#include <mutex>
 #include <vector>
 
 #include <wupsxx/bool_item.hpp>
@@ -21,12 +25,16 @@
 #include "cfg.hpp"
 
 #include "core.hpp"
+#include "export_item.hpp"
+#include "history.hpp"
 #include "notify.hpp"
 #include "preview_screen.hpp"
 #include "synchronize_item.hpp"
 #include "time_utils.hpp"
 #include "time_zone_offset_item.hpp"
 #include "time_zone_query_item.hpp"
+#include "trace.hpp"
+#include "tz.hpp"
 #include "utils.hpp"
 #include "verbosity_item.hpp"
 
@@ -51,12 +59,15 @@ namespace cfg {
     WUPSXX_OPTION("Synchronize on boot",
                   bool, sync_on_boot, true);
 
-    WUPSXX_OPTION("  └ Delay synchronization",
-                  seconds, sync_on_boot_delay, 5s, 0s, 30s);
+    WUPSXX_OPTION("  └ Wait for network (max)",
+                  seconds, sync_on_boot_max_wait, 30s, 0s, 60s);
 
     WUPSXX_OPTION("Synchronize after changing configuration",
                   bool, sync_on_changes, true);
 
+    WUPSXX_OPTION("Synchronize after network changes",
+                  bool, sync_on_network, true);
+
     WUPSXX_OPTION("Show notifications",
                   int, notify, 1, 0, 2);
 
@@ -67,11 +78,21 @@ namespace cfg {
                   minutes, utc_offset, 0min, -12h, 14h);
 
     WUPSXX_OPTION("  └ Detect time zone offset",
-                  int, tz_service, 0, 0, utils::get_num_tz_services());
+                  int, tz_service, 0, 0, utils::get_num_tz_services() - 1);
 
     WUPSXX_OPTION("    └ Auto update time zone",
                   bool, auto_tz, false);
 
+    WUPSXX_OPTION("      └ Cache time zone (days)",
+                  int, tz_cache_days, 7, 0, 30);
+
+    // Not shown in the menu: the last time zone fetched, and when it was fetched.
+    WUPSXX_OPTION("Cached time zone name",
+                  std::string, tz_name, "");
+
+    WUPSXX_OPTION("Cached time zone time",
+                  minutes, tz_fetch_time, 0min, 0min, 100 * 365 * 24h);
+
     WUPSXX_OPTION("Timeout",
                   seconds, timeout, 5s, 1s, 10s);
 
@@ -81,48 +102,305 @@ namespace cfg {
     WUPSXX_OPTION("NTP servers",
                   std::string, server, "pool.ntp.org");
 
+    WUPSXX_OPTION("  └ Use nearby pool zone",
+                  bool, regional_pool, true);
+
+    WUPSXX_OPTION("Discover LAN servers",
+                  bool, lan_discovery, true);
+
+    WUPSXX_OPTION("Listen for NTP broadcasts",
+                  bool, ntp_broadcast, false);
+
+    WUPSXX_OPTION("HTTP time servers",
+                  std::string, http_server, "");
+
+
+    namespace {
+
+        // Remembers the last value loaded or stored, so we only write what changed.
+        struct tracked_option_base {
+
+            virtual ~tracked_option_base() = default;
+
+            virtual void load() = 0;
+
+            // Returns true if the option had to be stored.
+            virtual bool store_if_dirty() = 0;
+
+        };
+
+
+        template<typename T>
+        struct tracked_option : tracked_option_base {
+
+            wups::option<T>& opt;
+            T saved{};
+
+
+            tracked_option(wups::option<T>& opt) :
+                opt(opt)
+            {}
+
+
+            void
+            load()
+                override
+            {
+                opt.load();
+                saved = opt.value;
+            }
+
+
+            bool
+            store_if_dirty()
+                override
+            {
+                if (opt.value == saved)
+                    return false;
+                opt.store();
+                saved = opt.value;
+                return true;
+            }
+
+        };
+
+
+        template<typename... Ts>
+        std::vector<std::unique_ptr<tracked_option_base>>
+        track(wups::option<Ts>&... opts)
+        {
+            std::vector<std::unique_ptr<tracked_option_base>> result;
+            (result.push_back(std::make_unique<tracked_option<Ts>>(opts)), ...);
+            return result;
+        }
 
-    std::vector<wups::option_base*> all_options = {
-        &sync_on_boot,
-        &sync_on_boot_delay,
-        &sync_on_changes,
-        &notify,
-        &msg_duration,
-        &utc_offset,
-        &tz_service,
-        &auto_tz,
-        &timeout,
-        &tolerance,
-        &server,
-    };
+
+        const auto all_options = track(sync_on_boot,
+                                       sync_on_boot_max_wait,
+                                       sync_on_changes,
+                                       sync_on_network,
+                                       notify,
+                                       msg_duration,
+                                       utc_offset,
+                                       tz_service,
+                                       auto_tz,
+                                       tz_cache_days,
+                                       tz_name,
+                                       tz_fetch_time,
+                                       timeout,
+                                       tolerance,
+                                       server,
+                                       regional_pool,
+                                       lan_discovery,
+                                       ntp_broadcast,
+                                       http_server);
+
+
+        // The worker thread may save while the menu is open.
+        std::mutex storage_mutex;
+
+        // Nothing is saved before the options are loaded, or the defaults would be stored.
+        std::atomic<bool> loaded = false;
+
+    } // namespace
 
 
     // variables that, if changed, may affect the sync
     namespace previous {
         bool         auto_tz;
+        bool         lan_discovery;
+        bool         ntp_broadcast;
+        bool         regional_pool;
+        bool         sync_on_network;
         milliseconds tolerance;
         int          tz_service;
         minutes      utc_offset;
     }
 
 
+    namespace {
+
+        // Readers keep the old snapshot alive while a new one is swapped in.
+        std::atomic<std::shared_ptr<const snapshot>> current_snapshot{
+            std::make_shared<const snapshot>()
+        };
+
+
+        /*
+         * Time zone stored by the sync worker, not yet copied into the options; only the
+         * menu thread touches the options. Protected by storage_mutex.
+         */
+        struct {
+            bool        valid = false;
+            std::string name;
+            minutes     offset{0};
+            minutes     fetch_time{0};
+        } worker_tz;
+
+
+        // Menu thread only, with storage_mutex held.
+        void
+        adopt_worker_tz()
+        {
+            if (!worker_tz.valid)
+                return;
+            worker_tz.valid = false;
+            // An offset changed by hand in the menu takes priority.
+            if (utc_offset.value == previous::utc_offset) {
+                utc_offset.value = worker_tz.offset;
+                previous::utc_offset = worker_tz.offset;
+            }
+            tz_name.value = worker_tz.name;
+            tz_fetch_time.value = worker_tz.fetch_time;
+        }
+
+
+        // Rebuilds the snapshot from the options, so it's only called from the menu thread.
+        void
+        publish_snapshot()
+        {
+            std::lock_guard lock{storage_mutex};
+            adopt_worker_tz();
+            current_snapshot = std::make_shared<const snapshot>(make_snapshot());
+        }
+
+
+        std::atomic<std::shared_ptr<const server_list>> current_servers{
+            std::make_shared<const server_list>()
+        };
+
+
+        void
+        add_unique(std::vector<std::string>& list,
+                   const std::string& source)
+        {
+            for (auto name : utils::token_range{source, " \t,;"})
+                if (std::ranges::find(list, name) == list.end())
+                    list.emplace_back(name);
+        }
+
+
+        // The default global pool often gives far away servers; use a nearby pool zone.
+        std::string
+        regional_server(const std::string& source,
+                        bool enabled,
+                        const char* zone_name)
+        {
+            if (!enabled || source != server.default_value)
+                return {};
+            auto zone = tz::pool_zone(zone_name);
+            if (!zone)
+                return {};
+            return std::string{*zone} + ".pool.ntp.org";
+        }
+
+
+        /*
+         * Only parses the sources again if anything changed since the last time. Called
+         * with storage_mutex held, since both the menu and the worker thread call it.
+         */
+        void
+        set_servers(const std::string& source,
+                    const std::string& http_source,
+                    std::string regional)
+        {
+            auto old_list = current_servers.load();
+            if (old_list->source == source
+                && old_list->http_source == http_source
+                && old_list->regional == regional)
+                return;
+
+            auto new_list = std::make_shared<server_list>();
+            new_list->source = source;
+            new_list->regional = std::move(regional);
+            if (new_list->regional.empty())
+                add_unique(new_list->names, new_list->source);
+            else
+                new_list->names.push_back(new_list->regional);
+            new_list->http_source = http_source;
+            add_unique(new_list->http_urls, new_list->http_source);
+
+            current_servers = std::move(new_list);
+        }
+
+
+        // Menu thread only; after publish_snapshot(), so the worker's time zone is used.
+        void
+        update_servers()
+        {
+            std::lock_guard lock{storage_mutex};
+            set_servers(server.value,
+                        http_server.value,
+                        regional_server(server.value,
+                                        regional_pool.value,
+                                        tz_name.value.data()));
+        }
+
+    } // namespace
+
+
+    snapshot
+    make_snapshot()
+        noexcept
+    {
+        snapshot result{
+            .auto_tz       = auto_tz.value,
+            .tz_service    = tz_service.value,
+            .timeout       = timeout.value,
+            .tolerance     = tolerance.value,
+            .utc_offset    = utc_offset.value,
+            .tz_cache_days = tz_cache_days.value,
+            .tz_fetch_time = tz_fetch_time.value,
+            .regional_pool = regional_pool.value,
+            .lan_discovery = lan_discovery.value,
+            .ntp_broadcast = ntp_broadcast.value,
+            .sync_on_network = sync_on_network.value,
+        };
+        tz_name.value.copy(result.tz_name.data(), result.tz_name.size() - 1);
+        return result;
+    }
+
+
+    snapshot
+    get_snapshot()
+        noexcept
+    {
+        return *current_snapshot.load();
+    }
+
+
+    std::shared_ptr<const server_list>
+    get_servers()
+        noexcept
+    {
+        return current_servers.load();
+    }
+
+
     void
     save_important_vars()
     {
-        previous::auto_tz    = auto_tz.value;
-        previous::tolerance  = tolerance.value;
-        previous::tz_service = tz_service.value;
-        previous::utc_offset = utc_offset.value;
+        previous::auto_tz         = auto_tz.value;
+        previous::lan_discovery   = lan_discovery.value;
+        previous::ntp_broadcast   = ntp_broadcast.value;
+        previous::regional_pool   = regional_pool.value;
+        previous::sync_on_network = sync_on_network.value;
+        previous::tolerance       = tolerance.value;
+        previous::tz_service      = tz_service.value;
+        previous::utc_offset      = utc_offset.value;
     }
 
 
     bool
     important_vars_changed()
     {
-        return previous::auto_tz    != auto_tz.value
-            || previous::tolerance  != tolerance.value
-            || previous::tz_service != tz_service.value
-            || previous::utc_offset != utc_offset.value;
+        return previous::auto_tz       != auto_tz.value
+            || previous::lan_discovery != lan_discovery.value
+            || previous::ntp_broadcast != ntp_broadcast.value
+            || previous::regional_pool != regional_pool.value
+            || previous::tolerance     != tolerance.value
+            || previous::tz_service    != tz_service.value
+            || previous::utc_offset    != utc_offset.value;
     }
 
 
@@ -135,10 +413,12 @@ namespace cfg {
 
         cat.add(make_item(sync_on_boot));
 
-        cat.add(make_item(sync_on_boot_delay));
+        cat.add(make_item(sync_on_boot_max_wait));
 
         cat.add(make_item(sync_on_changes));
 
+        cat.add(make_item(sync_on_network));
+
         cat.add(verbosity_item::create(notify));
 
         cat.add(make_item(msg_duration));
@@ -149,6 +429,8 @@ namespace cfg {
 
         cat.add(make_item(auto_tz));
 
+        cat.add(make_item(tz_cache_days));
+
         cat.add(make_item(timeout));
 
         cat.add(make_item(tolerance,
@@ -160,6 +442,14 @@ namespace cfg {
         // show current NTP server address, no way to change it.
         cat.add(make_item(server.label, server.value));
 
+        cat.add(make_item(regional_pool));
+
+        cat.add(make_item(lan_discovery));
+
+        cat.add(make_item(ntp_broadcast));
+
+        cat.add(make_item(http_server.label, http_server.value));
+
         return cat;
     }
 
@@ -175,6 +465,13 @@ namespace cfg {
         root.add(make_config_screen());
         root.add(make_preview_screen());
         root.add(synchronize_item::create());
+        root.add(export_item::create("Export trace",
+                                     []
+                                     {
+                                         trace::export_json();
+                                         return std::string{trace::default_path};
+                                     }));
+        root.add(export_item::create("Export sync history (CSV)", history::export_csv));
 
         save_important_vars();
     }
@@ -188,10 +485,16 @@ namespace cfg {
 
         notify::set_max_level(notify::level{notify.value});
         notify::set_duration(msg_duration.value);
+        publish_snapshot();
+        update_servers();
 
         if (sync_on_changes.value && important_vars_changed()) {
             core::background::stop();
             core::background::run(0s);
+        } else if (previous::sync_on_network != sync_on_network.value
+                   || previous::auto_tz != auto_tz.value) {
+            // The watcher stops by itself when it's no longer needed.
+            core::background::watch();
         }
 
         save();
@@ -203,10 +506,10 @@ namespace cfg {
         noexcept
     {
         try {
+            loaded = false;
             wups::init(PACKAGE_NAME,
                        menu_open,
                        menu_close);
-            load();
         }
         catch (std::exception& e) {
             logger::printf("Error in cfg::init(): %s\n", e.what());
@@ -217,10 +520,33 @@ namespace cfg {
     void
     load()
     {
-        for (auto& opt : all_options)
-            opt->load();
+        {
+            std::lock_guard lock{storage_mutex};
+            for (auto& opt : all_options)
+                opt->load();
+            loaded = true;
+            // The storage already has anything the worker stored.
+            worker_tz.valid = false;
+        }
         notify::set_max_level(notify::level{notify.value});
         notify::set_duration(msg_duration.value);
+        publish_snapshot();
+        update_servers();
+    }
+
+
+    void
+    load_once()
+        noexcept
+    {
+        if (loaded)
+            return;
+        try {
+            load();
+        }
+        catch (std::exception& e) {
+            logger::printf("Error in cfg::load_once(): %s\n", e.what());
+        }
     }
 
 
@@ -228,7 +554,11 @@ namespace cfg {
     reload()
     {
         try {
-            wups::reload();
+            {
+                // The sync worker may be storing the time zone.
+                std::lock_guard lock{storage_mutex};
+                wups::reload();
+            }
             load();
         }
         catch (std::exception& e) {
@@ -239,11 +569,18 @@ namespace cfg {
 
     void
     save()
+        noexcept
     {
         try {
+            std::lock_guard lock{storage_mutex};
+            if (!loaded)
+                return;
+            // Don't touch the SD card unless something actually changed.
+            bool dirty = false;
             for (const auto& opt : all_options)
-                opt->store();
-            wups::save();
+                dirty |= opt->store_if_dirty();
+            if (dirty)
+                wups::save();
         }
         catch (std::exception& e) {
             logger::printf("Error in cfg::save(): %s\n", e.what());
@@ -252,20 +589,61 @@ namespace cfg {
 
 
     void
-    set_and_store_utc_offset(minutes offset)
+    set_time_zone(const std::string& name,
+                  minutes offset,
+                  minutes fetch_time)
+    {
+        {
+            std::lock_guard lock{storage_mutex};
+            utc_offset.value = offset;
+            tz_name.value = name;
+            tz_fetch_time.value = fetch_time;
+            // This is newer than anything the worker stored.
+            worker_tz.valid = false;
+        }
+        publish_snapshot();
+    }
+
+
+    void
+    store_time_zone(const std::string& name,
+                    minutes offset,
+                    minutes fetch_time)
+        noexcept
     {
         logger::guard guard;
         /*
-         * Normally, `utc_offset` is saved when closing the config menu.
-         * If auto_tz is enabled, it will be updated and saved outside the config menu.
+         * Normally, options are saved when closing the config menu. If auto_tz is enabled,
+         * the time zone is updated outside the config menu; only its own keys are
+         * written, so no other option (maybe being edited in the menu) is touched.
          */
         try {
-            utc_offset.value = offset;
-            utc_offset.store();
+            std::lock_guard lock{storage_mutex};
+            wups::store(utc_offset.key, offset);
+            wups::store(tz_name.key, name);
+            wups::store(tz_fetch_time.key, fetch_time);
             wups::save();
+
+            worker_tz = {true, name, offset, fetch_time};
+
+            // The options can't be read here, so only these fields are changed.
+            auto snap = *current_snapshot.load();
+            snap.utc_offset = offset;
+            snap.tz_fetch_time = fetch_time;
+            snap.tz_name.fill('\0');
+            name.copy(snap.tz_name.data(), snap.tz_name.size() - 1);
+            current_snapshot = std::make_shared<const snapshot>(snap);
+
+            // A new time zone may have a different nearby pool.
+            auto servers = current_servers.load();
+            set_servers(servers->source,
+                        servers->http_source,
+                        regional_server(servers->source,
+                                        snap.regional_pool,
+                                        snap.tz_name.data()));
         }
         catch (std::exception& e) {
-            logger::printf("Error in cfg::set_and_store_utc_offset(): %s\n", e.what());
+            logger::printf("Error in cfg::store_time_zone(): %s\n", e.what());
         }
     }
 
@@ -10,34 +10,109 @@
 #ifndef CFG_HPP
 #define CFG_HPP
 
+#include <array>
 #include <chrono>
+#include <memory>               // shared_ptr<>
 #include <string>
+#include <type_traits>          // is_trivially_copyable_v<>
+#include <vector>
 
 #include <wupsxx/option.hpp>
 
 namespace cfg {
 
     extern wups::option<bool>                      auto_tz;
+    extern wups::option<std::string>               http_server;
+    extern wups::option<bool>                      lan_discovery;
     extern wups::option<std::chrono::seconds>      msg_duration;
     extern wups::option<int>                       notify;
+    extern wups::option<bool>                      ntp_broadcast;
+    extern wups::option<bool>                      regional_pool;
     extern wups::option<std::string>               server;
     extern wups::option<bool>                      sync_on_boot;
-    extern wups::option<std::chrono::seconds>      sync_on_boot_delay;
+    extern wups::option<std::chrono::seconds>      sync_on_boot_max_wait;
     extern wups::option<bool>                      sync_on_changes;
+    extern wups::option<bool>                      sync_on_network;
     extern wups::option<std::chrono::seconds>      timeout;
     extern wups::option<std::chrono::milliseconds> tolerance;
+    extern wups::option<int>                       tz_cache_days;
+    extern wups::option<std::chrono::minutes>      tz_fetch_time;
+    extern wups::option<std::string>               tz_name;
     extern wups::option<int>                       tz_service;
     extern wups::option<std::chrono::minutes>      utc_offset;
 
+    // Consistent copy of the options used by the sync, cheap to read from any thread.
+    struct snapshot {
+        bool                      auto_tz    = false;
+        int                       tz_service = 0;
+        std::chrono::seconds      timeout{};
+        std::chrono::milliseconds tolerance{};
+        std::chrono::minutes      utc_offset{};
+        int                       tz_cache_days = 0;
+        std::chrono::minutes      tz_fetch_time{}; // UTC, since 2000-01-01
+        std::array<char, 48>      tz_name{};       // truncated, always null-terminated
+        bool                      regional_pool = false;
+        bool                      lan_discovery = false;
+        bool                      ntp_broadcast = false;
+        bool                      sync_on_network = false;
+    };
+
+    static_assert(std::is_trivially_copyable_v<snapshot>);
+
+    // Copy of the current option values; only safe to call from the menu thread.
+    snapshot
+    make_snapshot()
+        noexcept;
+
+    // The last published snapshot; safe to call from any thread.
+    snapshot
+    get_snapshot()
+        noexcept;
+
+
+    /*
+     * NTP server names parsed from `server`, and HTTP time URLs parsed from
+     * `http_server`; it's only rebuilt when either changes, or the nearby pool does.
+     *
+     * When `regional_pool` is enabled and `server` has its default value, `names` only
+     * has the NTP pool zone closest to the time zone, in `regional`.
+     */
+    struct server_list {
+        std::string source;
+        std::string regional;
+        std::vector<std::string> names;
+        std::string http_source;
+        std::vector<std::string> http_urls;
+    };
+
+    std::shared_ptr<const server_list>
+    get_servers()
+        noexcept;
+
+
     void save_important_vars();
 
+    // Only registers the config menu; options are loaded later, by load_once().
     void init() noexcept;
 
     void load();
+    // Loads the options the first time it's called after init().
+    void load_once() noexcept;
     void reload();
-    void save();
+    // Only writes to storage if any option changed since it was loaded or saved.
+    void save() noexcept;
+
+    // Changes the time zone without saving it; also records when it was fetched.
+    // Only for the menu thread, the menu saves it when closed.
+    void set_time_zone(const std::string& name,
+                       std::chrono::minutes tz_offset,
+                       std::chrono::minutes fetch_time);
 
-    void set_and_store_utc_offset(std::chrono::minutes tz_offset);
+    // Like set_time_zone(), but for the sync worker: immediately stores only these keys.
+    void store_time_zone(const std::string& name,
+                         std::chrono::minutes tz_offset,
+                         std::chrono::minutes fetch_time)
+        noexcept;
 
 } // namespace cfg
 
@@ -117,13 +117,26 @@ clock_item::run()
         value.latency->text.clear();
     }
 
-    auto servers = utils::split(cfg::server.value, " \t,;");
+    /*
+     * NOTE: use what was last published, for both the servers and the options; the
+     * server list is not rebuilt until the menu closes, so the option values being
+     * edited wouldn't match it.
+     */
+    const auto servers = cfg::get_servers();
+    const auto snap = cfg::get_snapshot();
 
     dbl_seconds total = 0s;
     unsigned num_values = 0;
 
-    for (const auto& server : servers) {
-        auto& si = server_infos.at(server);
+    for (const auto& server : servers->names) {
+        // The list may have been republished after the preview items were created.
+        auto si_it = server_infos.find(server);
+        if (si_it == server_infos.end()) {
+            logger::printf("Skipping server %s, it was added after the menu opened.\n",
+                           server.data());
+            continue;
+        }
+        auto& si = si_it->second;
         try {
             // NOTE: be as specific as possible about the name we want to resolve.
             net::addrinfo::hints opts{ .type = net::socket::type::udp };
@@ -137,22 +150,23 @@ clock_item::run()
             unsigned errors = 0;
 
             for (const auto& info : infos) {
-                try {
-                    auto [correction, latency] = core::ntp_query({}, info.addr);
-                    server_corrections.push_back(correction);
-                    server_latencies.push_back(latency);
-                    total += correction;
-                    ++num_values;
-                    logger::printf("%s (%s): correction = %s, latency = %s\n",
-                                   server.data(),
-                                   to_string(info.addr).data(),
-                                   seconds_to_human(correction, true).data(),
-                                   seconds_to_human(latency).data());
-                }
-                catch (std::exception& e) {
+                auto result = core::ntp_query({}, info.addr, snap);
+                if (!result) {
                     ++errors;
-                    logger::printf("Error: %s\n", e.what());
+                    logger::printf("Error: %s\n", to_string(result.error()).data());
+                    continue;
                 }
+                auto [correction, latency, stratum] = *result;
+                server_corrections.push_back(correction);
+                server_latencies.push_back(latency);
+                total += correction;
+                ++num_values;
+                logger::printf("%s (%s): correction = %s, latency = %s, stratum = %u\n",
+                               server.data(),
+                               to_string(info.addr).data(),
+                               seconds_to_human(correction, true).data(),
+                               seconds_to_human(latency).data(),
+                               unsigned{stratum});
             }
 
             if (errors)
@@ -7,15 +7,25 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <algorithm>            // max(), min(), ranges::{find(), max(), nth_element(), stable_partition(), transform()}
+#include <array>
 #include <atomic>
 #include <chrono>
+#include <cstddef>              // byte, max_align_t
+#include <cstdint>
 #include <cstdio>               // snprintf()
-#include <numeric>              // accumulate()
+#include <exception>            // current_exception(), exception_ptr, rethrow_exception()
+#include <map>
+#include <memory_resource>
+#include <optional>
 #include <ranges>               // views::zip()
 #include <set>
+#include <span>
 #include <stdexcept>            // runtime_error
+#include <stop_token>           // stop_callback<>
 #include <string>
 #include <thread>
+#include <utility>              // pair<>
 #include <vector>
 
 #include <coreinit/time.h>
@@ -27,11 +37,18 @@
 #include "core.hpp"
 
 #include "cfg.hpp"
+#include "discovery.hpp"
+#include "history.hpp"
+#include "http_client.hpp"
 #include "net/addrinfo.hpp"
 #include "net/socket.hpp"
 #include "notify.hpp"
 #include "ntp.hpp"
+#include "realtime.hpp"
+#include "time_service.hpp"
 #include "time_utils.hpp"
+#include "trace.hpp"
+#include "tz.hpp"
 #include "utc.hpp"
 #include "utils.hpp"
 
@@ -55,6 +72,9 @@ namespace {
     constexpr dbl_seconds seconds_per_day{24 * 60 * 60};
     constexpr dbl_seconds epoch_diff = seconds_per_day * (100 * 365 + 24);
 
+    // Wii U epoch, as a calendar date.
+    constexpr std::chrono::sys_days wiiu_epoch{std::chrono::year{2000} / 1 / 1};
+
 
     // Wii U -> NTP epoch.
     ntp::timestamp
@@ -64,14 +84,6 @@ namespace {
     }
 
 
-    // NTP -> Wii U epoch.
-    utc::timestamp
-    to_utc(ntp::timestamp t)
-    {
-        return utc::timestamp{static_cast<dbl_seconds>(t) - epoch_diff};
-    }
-
-
     std::string
     ticks_to_string(OSTime wt)
     {
@@ -86,14 +98,73 @@ namespace {
     }
 
 
-    std::string
-    to_string(ntp::timestamp t)
+    // Current UTC time, in whole minutes since 2000-01-01.
+    std::chrono::minutes
+    utc_minutes(std::chrono::minutes utc_offset)
     {
-        auto ut = to_utc(t);
-        OSTime ticks = ut.value.count() * OSTimerClockSpeed;
-        return ticks_to_string(ticks);
+        return std::chrono::floor<std::chrono::minutes>(utc::now(utc_offset).value);
+    }
+
+
+    /*
+     * Checks if the cached time zone can still be used.
+     *
+     * For zones in the embedded rules table the offset is computed locally, so only the
+     * age matters. For other zones we don't know when the next DST change is, so any
+     * date in a month where DST usually changes (in either hemisphere) is treated as a
+     * possible change: the cache is then only trusted within the same day.
+     */
+    bool
+    tz_cache_valid(const cfg::snapshot& snap)
+    {
+        using namespace std::chrono;
+
+        if (!snap.tz_cache_days || !snap.tz_name[0] || snap.tz_fetch_time == 0min)
+            return false;
+
+        const minutes now = utc_minutes(snap.utc_offset);
+        if (now < snap.tz_fetch_time) // clock went backwards
+            return false;
+        if (now - snap.tz_fetch_time >= days{snap.tz_cache_days})
+            return false;
+
+        if (tz::find(snap.tz_name.data()))
+            return true;
+
+        const year_month_day then_date{floor<days>(wiiu_epoch + snap.tz_fetch_time
+                                                   + snap.utc_offset)};
+        const year_month_day now_date{floor<days>(wiiu_epoch + now + snap.utc_offset)};
+        if (then_date == now_date)
+            return true;
+
+        constexpr std::array dst_months = {
+            March, April, September, October, November
+        };
+        for (auto ym = then_date.year() / then_date.month();
+             ym <= now_date.year() / now_date.month();
+             ym += months{1})
+            if (std::ranges::find(dst_months, ym.month()) != dst_months.end())
+                return false;
+
+        return true;
     }
 
+
+    // Logs how many allocations a sync needed, and how many of them reached the heap.
+    struct allocation_report {
+
+        const utils::counting_resource& total;
+        const utils::counting_resource& heap;
+
+        ~allocation_report()
+        {
+            logger::printf("Sync allocations: %zu (%zu bytes), from heap: %zu (%zu bytes)\n",
+                           total.allocations, total.bytes,
+                           heap.allocations, heap.bytes);
+        }
+
+    };
+
 } // namespace
 
 
@@ -126,42 +197,111 @@ namespace core {
     }
 
 
+    std::string
+    to_string(query_error e)
+    {
+        using std::to_string;
+        using code = query_error::code;
+
+        auto errno_str = [&e] -> std::string
+        {
+            return std::make_error_code(std::errc{e.detail}).message();
+        };
+
+        switch (e.what) {
+        case code::canceled:
+            return "Operation canceled.";
+        case code::socket:
+            return "Could not create socket: "s + errno_str();
+        case code::connect:
+            return "Could not connect socket: "s + errno_str();
+        case code::send:
+            return "send() failed: "s + errno_str();
+        case code::send_retries:
+            return "No resources for send(), too many retries!";
+        case code::poll:
+            return "poll() failed: "s + errno_str();
+        case code::poll_retries:
+            return "No resources for poll(), too many retries!";
+        case code::timeout:
+            return "Timeout reached!";
+        case code::recv:
+            return "recv() failed: "s + errno_str();
+        case code::short_packet:
+            return "Invalid NTP response!";
+        case code::bad_version:
+            return "Unsupported NTP version: "s + to_string(e.detail);
+        case code::bad_mode:
+            return "Invalid NTP packet mode: "s
+                + ntp::to_string(static_cast<ntp::packet::mode_flag>(e.detail));
+        case code::bad_leap:
+            return "Unknown value for leap flag.";
+        case code::origin_mismatch:
+            return "NTP response mismatch.";
+        case code::bad_timestamps:
+            return "NTP response has invalid timestamps.";
+        default:
+            return "Unknown error.";
+        }
+    }
+
+
     // NOTE: hardcoded for IPv4, the Wii U doesn't have IPv6.
-    correction_latency_t
+    std::expected<sample, query_error>
     ntp_query(std::stop_token token,
-              net::address address)
+              net::address address,
+              const cfg::snapshot& snap)
+        noexcept
     {
-        using std::to_string;
+        using code = query_error::code;
+        using std::unexpected;
+
+        trace::add(trace::counter::queries);
 
-        net::socket sock{net::socket::type::udp};
-        sock.connect(address);
+        auto sock_status = net::socket::try_make_udp();
+        if (!sock_status)
+            return unexpected{query_error{code::socket,
+                                          sock_status.error().code().value()}};
+        net::socket sock = std::move(*sock_status);
+
+        if (auto status = sock.try_connect(address); !status)
+            return unexpected{query_error{code::connect, status.error().code().value()}};
 
         ntp::packet packet;
         packet.version(4);
         packet.mode(ntp::packet::mode_flag::client);
 
+        // Keep the game from preempting us between a timestamp and the packet I/O.
+        realtime::guard rt_guard;
+
 
         unsigned send_attempts = 0;
         const unsigned max_send_attempts = 4;
 
     try_again_send:
         // cancellation point: before sending
-        throw_if_stop(token);
-        auto t1 = to_ntp(utc::now());
+        if (token.stop_requested())
+            return unexpected{query_error{code::canceled}};
+        trace::span send_span{"ntp send"};
+        auto t1 = to_ntp(utc::now(snap.utc_offset));
         packet.transmit_time = t1;
 
         auto send_status = sock.try_send(&packet, sizeof packet);
+        // Recording takes a lock, so it's only done after t4 is measured.
+        send_span.stop();
         if (!send_status) {
             auto& e = send_status.error();
             if (e.code() != std::errc::not_enough_memory)
-                throw e;
+                return unexpected{query_error{code::send, e.code().value()}};
+            trace::add(trace::counter::enomem_retries);
             if (++send_attempts < max_send_attempts) {
                 // cancellation point: before sleeping
-                throw_if_stop(token);
+                if (token.stop_requested())
+                    return unexpected{query_error{code::canceled}};
                 std::this_thread::sleep_for(100ms);
                 goto try_again_send;
             } else
-                throw runtime_error{"No resources for send(), too many retries!"};
+                return unexpected{query_error{code::send_retries}};
         }
 
 
@@ -170,51 +310,64 @@ namespace core {
 
     try_again_poll:
         // cancellation point: before polling
-        throw_if_stop(token);
-        auto readable_status = sock.try_is_readable(cfg::timeout.value);
+        if (token.stop_requested())
+            return unexpected{query_error{code::canceled}};
+        trace::span poll_span{"ntp poll"};
+        auto readable_status = sock.try_is_readable(snap.timeout);
         if (!readable_status) {
             // Wii U OS can only handle 16 concurrent select()/poll() calls,
             // so we may need to try again later.
             auto& e = readable_status.error();
             if (e.code() != std::errc::not_enough_memory)
-                throw e;
+                return unexpected{query_error{code::poll, e.code().value()}};
+            trace::add(trace::counter::enomem_retries);
             if (++poll_attempts < max_poll_attempts) {
                 // cancellation point: before sleeping
-                throw_if_stop(token);
+                if (token.stop_requested())
+                    return unexpected{query_error{code::canceled}};
                 std::this_thread::sleep_for(10ms);
                 goto try_again_poll;
             } else
-                throw runtime_error{"No resources for poll(), too many retries!"};
+                return unexpected{query_error{code::poll_retries}};
         }
 
-        if (!*readable_status)
-            throw runtime_error{"Timeout reached!"};
+        if (!*readable_status) {
+            trace::add(trace::counter::bytes_sent, sizeof packet);
+            trace::add(trace::counter::timeouts);
+            return unexpected{query_error{code::timeout}};
+        }
 
         // Measure the arrival time as soon as possible.
-        auto t4 = to_ntp(utc::now());
-
-        if (sock.recv(&packet, sizeof packet) < 48)
-            throw runtime_error{"Invalid NTP response!"};
-
-        sock.close(); // close it early
+        auto t4 = to_ntp(utc::now(snap.utc_offset));
+        poll_span.finish();
+        send_span.finish();
+        trace::add(trace::counter::bytes_sent, sizeof packet);
+
+        trace::span recv_span{"ntp recv"};
+        auto recv_status = sock.try_recv(&packet, sizeof packet);
+        recv_span.finish();
+        if (!recv_status)
+            return unexpected{query_error{code::recv,
+                                          recv_status.error().code().value()}};
+        trace::add(trace::counter::bytes_received, *recv_status);
+        if (*recv_status < 48)
+            return unexpected{query_error{code::short_packet}};
 
         auto v = packet.version();
         if (v < 3 || v > 4)
-            throw runtime_error{"Unsupported NTP version: "s + to_string(v)};
+            return unexpected{query_error{code::bad_version, static_cast<int>(v)}};
 
         auto m = packet.mode();
         if (m != ntp::packet::mode_flag::server)
-            throw runtime_error{"Invalid NTP packet mode: "s + to_string(m)};
+            return unexpected{query_error{code::bad_mode, static_cast<int>(m)}};
 
         auto l = packet.leap();
         if (l == ntp::packet::leap_flag::unknown)
-            throw runtime_error{"Unknown value for leap flag."};
+            return unexpected{query_error{code::bad_leap}};
 
         ntp::timestamp t1_received = packet.origin_time;
         if (t1 != t1_received)
-            throw runtime_error{"NTP response mismatch: ["s
-                                + ::to_string(t1) + "] vs ["s
-                                + ::to_string(t1_received) + "]"s};
+            return unexpected{query_error{code::origin_mismatch}};
 
         // when our request arrived at the server
         auto t2 = packet.receive_time;
@@ -223,7 +376,7 @@ namespace core {
 
         // Zero is not a valid timestamp.
         if (!t2 || !t3)
-            throw runtime_error{"NTP response has invalid timestamps."};
+            return unexpected{query_error{code::bad_timestamps}};
 
         /*
          * We do all calculations in double precision to never worry about overflows. Since
@@ -264,7 +417,7 @@ namespace core {
         if (correction < -quarter_era) // if correcting more than 68 years backward
             correction += half_era;
 
-        return { correction, latency };
+        return sample{ correction, latency, packet.stratum };
     }
 
 
@@ -272,43 +425,358 @@ namespace core {
     bool
     apply_clock_correction(dbl_seconds seconds)
     {
-        // OSTime before = OSGetSystemTime();
+        trace::span total_span{"apply correction"};
 
         OSTime ticks = seconds.count() * OSTimerClockSpeed;
 
         nn::pdm::NotifySetTimeBeginEvent();
 
-        // OSTime ccr_start = OSGetSystemTime();
+        trace::span ccr_span{"CCRSysSetSystemTime"};
         bool success1 = !CCRSysSetSystemTime(OSGetTime() + ticks);
-        // OSTime ccr_finish = OSGetSystemTime();
+        ccr_span.finish();
 
-        // OSTime abs_start = OSGetSystemTime();
+        trace::span abs_span{"__OSSetAbsoluteSystemTime"};
         bool success2 = __OSSetAbsoluteSystemTime(OSGetTime() + ticks);
-        // OSTime abs_finish = OSGetSystemTime();
+        abs_span.finish();
 
         nn::pdm::NotifySetTimeEndEvent();
 
-        // logger::printf("CCRSysSetSystemTime() took %f ms\n",
-        //                1000.0 * (ccr_finish - ccr_start) / OSTimerClockSpeed);
-        // logger::printf("__OSSetAbsoluteSystemTime() took %f ms\n",
-        //                1000.0 * (abs_finish - abs_start) / OSTimerClockSpeed);
-
-        // OSTime after = OSGetSystemTime();
-        // logger::printf("Total time: %f ms\n",
-        //                1000.0 * (after - before) / OSTimerClockSpeed);
+        // Broadcasts received before the change were timestamped with the old clock.
+        discovery::forget_broadcast();
 
         return success1 && success2;
     }
 
 
+    namespace {
+
+        // A successful NTP query.
+        struct measurement {
+            dbl_seconds correction;
+            dbl_seconds latency;
+            bool lan; // from a server in the local network
+            std::uint8_t stratum = 0;
+            std::uint32_t ip = 0; // the server's address, for the history
+        };
+
+
+        // Average correction; the latency and stratum are the worst ones.
+        measurement
+        combine(std::span<const measurement> ms)
+        {
+            measurement result{dbl_seconds{0}, dbl_seconds{0}, true, 0};
+            for (const auto& m : ms) {
+                result.correction += m.correction;
+                result.latency = std::max(result.latency, m.latency);
+                result.lan = result.lan && m.lan;
+                result.stratum = std::max(result.stratum, m.stratum);
+            }
+            result.correction /= static_cast<double>(ms.size());
+            return result;
+        }
+
+
+        /*
+         * Servers in the local network have much lower latency, so they're preferred; but
+         * only if they agree with the internet servers, within the internet latencies.
+         */
+        measurement
+        combine_corrections(std::pmr::vector<measurement>& ms)
+        {
+            trace::span span{"selection"};
+            auto lan_end = std::ranges::stable_partition(ms, &measurement::lan).begin();
+            std::span<const measurement> lan{ms.begin(), lan_end};
+            std::span<const measurement> internet{lan_end, ms.end()};
+            if (lan.empty() || internet.empty())
+                return combine(ms);
+
+            const auto lan_result = combine(lan);
+            const auto internet_result = combine(internet);
+            const dbl_seconds diff = lan_result.correction - internet_result.correction;
+            if (abs(diff) <= internet_result.latency + 10ms)
+                return lan_result;
+
+            logger::printf("LAN servers disagree with internet servers (%s vs %s),"
+                           " ignoring them.\n",
+                           time_utils::seconds_to_human(lan_result.correction, true).data(),
+                           time_utils::seconds_to_human(internet_result.correction, true).data());
+            return internet_result;
+        }
+
+
+        std::int64_t
+        to_us(dbl_seconds s)
+            noexcept
+        {
+            return std::chrono::round<std::chrono::microseconds>(s).count();
+        }
+
+
+        dbl_seconds
+        median_latency(std::span<const measurement> corrections)
+        {
+            if (corrections.empty())
+                return 0s;
+            std::vector<dbl_seconds> latencies(corrections.size());
+            std::ranges::transform(corrections, latencies.begin(), &measurement::latency);
+            auto mid = latencies.begin() + latencies.size() / 2;
+            std::ranges::nth_element(latencies, mid);
+            return *mid;
+        }
+
+
+        /*
+         * Result of a regular client query to each broadcast server: it calibrates the
+         * one-way delay, and is the reference that broadcasts must agree with. No locking
+         * is needed, since run() never executes in parallel.
+         */
+        struct broadcast_check {
+            dbl_seconds delay;
+            dbl_seconds correction;
+            std::chrono::steady_clock::time_point when;
+        };
+
+        std::map<net::address, broadcast_check> broadcast_checks;
+
+
+        // Broadcast servers usually send every 64 seconds; older samples are ignored.
+        constexpr std::chrono::seconds broadcast_max_age{180};
+
+        // The client query is repeated at least this often.
+        constexpr std::chrono::hours broadcast_recheck{1};
+
+        // How far a broadcast can be from the client query, to be used.
+        constexpr dbl_seconds broadcast_agreement{1};
+
+
+        std::optional<broadcast_check>
+        check_broadcast_server(std::stop_token token,
+                               net::address from,
+                               const cfg::snapshot& snap)
+        {
+            net::address server{from.ip, 123};
+            auto result = ntp_query(token, server, snap);
+            if (!result) {
+                logger::printf("ERROR checking broadcast server %s: %s\n",
+                               to_string(server).data(),
+                               to_string(result.error()).data());
+                return {};
+            }
+            logger::printf("Checked broadcast server %s: delay = %s\n",
+                           to_string(from).data(),
+                           time_utils::seconds_to_human(result->latency).data());
+            return broadcast_check{result->latency,
+                                   result->correction,
+                                   std::chrono::steady_clock::now()};
+        }
+
+
+        /*
+         * Uses the last NTP broadcast heard by the listener thread.
+         *
+         * A broadcast is unauthenticated, and anyone in the LAN can send one; so it's only
+         * used if it agrees with a client query to the same server, made at most an hour
+         * ago. The query also calibrates the delay. If they disagree, the query is repeated
+         * once, in case the clock changed since; then the broadcast is rejected.
+         */
+        std::optional<measurement>
+        receive_broadcast(std::stop_token token,
+                          const cfg::snapshot& snap)
+        {
+            auto heard = discovery::last_broadcast(broadcast_max_age);
+            if (!heard)
+                return {};
+
+            auto sent = static_cast<dbl_seconds>(heard->packet.transmit_time);
+            auto received = static_cast<dbl_seconds>(
+                to_ntp(utc::timestamp{heard->received_local - snap.utc_offset}));
+            auto correction_for = [sent, received](dbl_seconds delay)
+            {
+                // Same Era wraparound handling as in ntp_query().
+                constexpr dbl_seconds half_era{0x1.0p32};
+                constexpr dbl_seconds quarter_era{0x1.0p31};
+                dbl_seconds correction = sent + delay - received;
+                if (correction > quarter_era)
+                    correction -= half_era;
+                if (correction < -quarter_era)
+                    correction += half_era;
+                return correction;
+            };
+
+            auto check_it = broadcast_checks.find(heard->from);
+            bool fresh = false;
+            if (check_it == broadcast_checks.end()
+                || std::chrono::steady_clock::now() - check_it->second.when > broadcast_recheck) {
+                auto check = check_broadcast_server(token, heard->from, snap);
+                if (!check)
+                    return {};
+                check_it = broadcast_checks.insert_or_assign(heard->from, *check).first;
+                fresh = true;
+            }
+
+            dbl_seconds correction = correction_for(check_it->second.delay);
+            if (abs(correction - check_it->second.correction) > broadcast_agreement && !fresh) {
+                auto check = check_broadcast_server(token, heard->from, snap);
+                if (!check)
+                    return {};
+                check_it->second = *check;
+                correction = correction_for(check->delay);
+            }
+
+            if (abs(correction - check_it->second.correction) > broadcast_agreement) {
+                logger::printf("WARNING: ignoring broadcast from %s, its correction %s"
+                               " disagrees with the client query's %s.\n",
+                               to_string(heard->from).data(),
+                               time_utils::seconds_to_human(correction, true).data(),
+                               time_utils::seconds_to_human(check_it->second.correction,
+                                                            true).data());
+                broadcast_checks.erase(check_it);
+                return {};
+            }
+
+            return measurement{correction,
+                               check_it->second.delay,
+                               true,
+                               heard->packet.stratum,
+                               heard->from.ip};
+        }
+
+
+        /*
+         * Publishes the result for other homebrew, see "time_sync.h". The drift is
+         * estimated from how far the clock moved since the previous sync; `residual` is
+         * the error left uncorrected, and `tz_shift` is how much of the correction came
+         * from a time zone change during this sync.
+         */
+        void
+        publish_state(const measurement& m,
+                      dbl_seconds residual,
+                      dbl_seconds tz_shift)
+        {
+            // Only accessed by run(), which never executes in parallel.
+            static OSTime prev_uptime = 0;
+            static dbl_seconds prev_residual{0};
+
+            // NOTE: OSGetSystemTime() is not affected by clock changes.
+            const OSTime uptime = OSGetSystemTime();
+            double drift_ppm = 0;
+            if (prev_uptime) {
+                dbl_seconds elapsed{static_cast<double>(uptime - prev_uptime) / OSTimerClockSpeed};
+                // A time zone change moves the clock too, but that's not drift.
+                if (elapsed > 0s)
+                    drift_ppm = (m.correction - tz_shift - prev_residual) / elapsed * 1e6;
+            }
+            prev_uptime = uptime;
+            prev_residual = residual;
+
+            using std::chrono::nanoseconds;
+            time_service::publish({
+                    .offset_ns       = duration_cast<nanoseconds>(m.correction).count(),
+                    .residual_ns     = duration_cast<nanoseconds>(residual).count(),
+                    .error_bound_ns  = duration_cast<nanoseconds>(m.latency).count(),
+                    .drift_ppm       = drift_ppm,
+                    .last_sync_ticks = OSGetTime(),
+                    .stratum         = m.stratum,
+                });
+        }
+
+
+        // Coarse clock correction, from the Date header of a HTTP response.
+        struct http_estimate {
+            dbl_seconds correction;
+            dbl_seconds uncertainty;
+        };
+
+
+        http_estimate
+        estimate_from_date(const http::date_sample& sample,
+                           std::chrono::minutes utc_offset)
+        {
+            // Where the local clock was when the header arrived.
+            auto since_received = std::chrono::steady_clock::now() - sample.received;
+            dbl_seconds local_received = utc::now(utc_offset).value - since_received;
+            // The server wrote the header at some point during the round trip.
+            dbl_seconds local_mid = local_received - sample.rtt / 2;
+            // The header is truncated to whole seconds.
+            dbl_seconds server = sample.server_time - wiiu_epoch + 0.5s;
+            return { server - local_mid, 0.5s + sample.rtt / 2 };
+        }
+
+
+        /*
+         * Gets the time from the configured HTTP time servers. Without those, use any Date
+         * header received since `start`, like the one from the time zone service.
+         */
+        std::optional<http_estimate>
+        get_http_time(std::chrono::steady_clock::time_point start,
+                      const cfg::server_list& servers,
+                      const cfg::snapshot& snap,
+                      std::stop_token token)
+        {
+            for (const auto& url : servers.http_urls) {
+                try {
+                    auto sample = http::get_date(url, token, snap.timeout);
+                    return estimate_from_date(sample, snap.utc_offset);
+                }
+                catch (std::exception& e) {
+                    throw_if_stop(token);
+                    logger::printf("ERROR getting time from %s: %s\n", url.data(), e.what());
+                }
+            }
+
+            auto sample = http::last_date();
+            if (sample && sample->received >= start)
+                return estimate_from_date(*sample, snap.utc_offset);
+
+            return {};
+        }
+
+
+        // Appends the history record when the sync ends, however it ends.
+        struct history_writer {
+
+            history::record rec;
+            const std::chrono::minutes& utc_offset;
+            std::stop_token token;
+
+            ~history_writer()
+            {
+                if (rec.result == history::outcome::failed && token.stop_requested())
+                    rec.result = history::outcome::canceled;
+                rec.time_us = to_us(utc::now(utc_offset).value);
+                history::append(rec);
+            }
+
+
+            // Servers that answered come first, so they're kept if there are too many.
+            void
+            add_servers(std::span<const measurement> corrections,
+                        std::span<const history::server> failures)
+                noexcept
+            {
+                for (const auto& c : corrections)
+                    rec.add({
+                            .ip = c.ip,
+                            .delay_us = static_cast<std::uint32_t>(to_us(c.latency)),
+                            .offset_us = to_us(c.correction),
+                            .stratum = c.stratum,
+                            .lan = c.lan,
+                        });
+                for (const auto& f : failures)
+                    rec.add(f);
+            }
+
+        };
+
+    } // namespace
+
+
     void
     run(std::stop_token token,
         bool silent)
     {
         using time_utils::seconds_to_human;
 
-        utils::network_guard net_guard;
-
         static std::atomic<bool> executing = false;
         utils::exec_guard exec_guard{executing};
         if (!exec_guard.guarded) {
@@ -316,43 +784,105 @@ namespace core {
             throw runtime_error{"Skipping NTP task: operation already in progress."};
         }
 
-        if (cfg::auto_tz.value) {
-            try {
-                auto [name, offset] = utils::fetch_timezone(cfg::tz_service.value);
-                if (offset != cfg::utc_offset.value) {
-                    cfg::set_and_store_utc_offset(offset);
+        /*
+         * All the temporary memory used by the sync comes from a fixed-size arena, that
+         * is released in one go when this function returns; only what doesn't fit will
+         * fall back to the heap. Since this function never runs in parallel (see
+         * exec_guard above) the arena buffer can be static.
+         */
+        alignas(std::max_align_t) static std::byte arena_buffer[16 * 1024];
+        utils::counting_resource heap_mem;
+        std::pmr::monotonic_buffer_resource arena{arena_buffer,
+                                                  sizeof arena_buffer,
+                                                  &heap_mem};
+        utils::counting_resource mem{&arena};
+        allocation_report report{mem, heap_mem};
+
+        // Only HTTP responses received after this are recent enough to be used.
+        const auto start = std::chrono::steady_clock::now();
+
+        // Read the configuration only once, the menu may change it while we run.
+        auto snap = cfg::get_snapshot();
+        const auto servers = cfg::get_servers();
+        const std::chrono::minutes initial_offset = snap.utc_offset;
+
+        history_writer hist{{}, snap.utc_offset, token};
+
+        utils::network_guard net_guard;
+
+        /*
+         * The time zone is fetched concurrently with the NTP queries, since the UTC
+         * offset is only needed to convert the final correction.
+         *
+         * NOTE: the arena is not thread-safe, so the fetch uses the default resource.
+         *
+         * The thread uses our network lease, and stops together with this function: it's
+         * stopped and joined on any early exit, and a stop on `token` is forwarded to it.
+         */
+        std::pair<std::string, std::chrono::minutes> tz_value;
+        std::exception_ptr tz_error;
+        std::jthread tz_thread;
+        if (snap.auto_tz && tz_cache_valid(snap)) {
+            logger::printf("Using cached time zone: %s\n", snap.tz_name.data());
+            if (auto zone = tz::find(snap.tz_name.data())) {
+                auto offset = tz::offset_at(*zone, utc_minutes(snap.utc_offset));
+                if (offset != snap.utc_offset) {
+                    cfg::store_time_zone(snap.tz_name.data(), offset, snap.tz_fetch_time);
+                    snap.utc_offset = offset;
                     if (!silent)
                         notify::info(notify::level::verbose,
                                      "Updated time zone to %s (%s)",
-                                     name.data(),
+                                     snap.tz_name.data(),
                                      time_utils::tz_offset_to_string(offset).data());
                 }
             }
+        } else if (snap.auto_tz)
+            tz_thread = std::jthread{
+                [&tz_value, &tz_error, service = snap.tz_service](std::stop_token tz_token)
+                {
+                    try {
+                        tz_value = utils::fetch_timezone(service, tz_token);
+                    }
+                    catch (...) {
+                        tz_error = std::current_exception();
+                    }
+                }};
+        std::stop_callback tz_stopper{token, [&tz_thread] { tz_thread.request_stop(); }};
+
+        std::pmr::vector<measurement> corrections{&mem};
+
+        // A broadcast from a local server gives us the time without sending anything.
+        if (snap.ntp_broadcast) {
+            try {
+                if (auto m = receive_broadcast(token, snap))
+                    corrections.push_back(*m);
+            }
             catch (std::exception& e) {
-                if (!silent)
-                    notify::error(notify::level::verbose,
-                                  "Failed to update time zone: %s",
-                                  e.what());
-                // NOTE: not a fatal error, we just keep using the previous time zone.
+                throw_if_stop(token);
+                logger::printf("ERROR using NTP broadcast: %s\n", e.what());
             }
         }
+        const bool passive = !corrections.empty();
+        if (passive)
+            hist.rec.src = history::source::broadcast;
 
-        // cancellation point: after the time zone update
-        throw_if_stop(token);
-
-        const auto servers = utils::split(cfg::server.value, " \t,;");
-
-        std::vector<dbl_seconds> corrections;
+        // The nearby pool zone, if enabled, is already in the server list.
+        std::pmr::vector<std::pmr::string> names{servers->names.begin(),
+                                                 servers->names.end(),
+                                                 &mem};
+        if (passive)
+            names.clear();
 
         // First, resolve all addresses. Some IP addresses might be duplicated when we
         // use "pool.ntp.org", so we use a set to deduplicate.
-        std::set<net::address> addresses;
-        for (auto& server : servers) {
+        std::pmr::set<net::address> addresses{&mem};
+        for (auto& server : names) {
             try {
                 throw_if_stop(token);
                 // NOTE: be as specific as possible about the name we want to resolve.
                 net::addrinfo::hints opts { .type = net::socket::type::udp };
-                auto resolved = net::addrinfo::lookup(server, "123", opts);
+                trace::span dns_span{"dns lookup"};
+                auto resolved = net::addrinfo::lookup(server, "123", opts, &mem);
                 for (const auto& address : resolved)
                     addresses.insert(address.addr);
             }
@@ -360,51 +890,147 @@ namespace core {
                 throw;
             }
             catch (std::exception& e) {
-                logger::printf("ERROR resolving server %s: %s\n", server.data(), e.what());
-                if (!silent)
-                    notify::error(notify::level::verbose,
-                                  "%s: %s",
-                                  server.data(),
-                                  e.what());
+                notify::log("ERROR resolving server %s: %s", server.data(), e.what());
             }
         }
 
-        // Now perform a NTP query on each address to collect all corrections.
-        for (const auto& address : addresses) {
-            auto address_str = to_string(address);
+        // Servers in the local network, if there are any.
+        std::pmr::set<net::address> lan_addresses{&mem};
+        if (snap.lan_discovery && !passive) {
             try {
-                auto [correction, latency] = ntp_query(token, address);
-                corrections.push_back(correction);
-                notify::info(notify::level::verbose,
-                             "%s: correction = %s, latency = %s",
-                             address_str.data(),
-                             seconds_to_human(correction, true).data(),
-                             seconds_to_human(latency).data());
+                for (auto address : discovery::get_lan_servers(token, 250ms))
+                    lan_addresses.insert(address);
+                addresses.insert(lan_addresses.begin(), lan_addresses.end());
             }
-            catch (canceled_error&) {
-                throw;
+            catch (std::exception& e) {
+                logger::printf("ERROR discovering LAN servers: %s\n", e.what());
+            }
+        }
+
+        /*
+         * Now perform a NTP query on each address to collect all corrections. Details
+         * only go to the log; a single summary is shown at the end.
+         */
+        std::size_t responses = 0;
+        std::pmr::vector<history::server> failures{&mem};
+        for (const auto& address : addresses) {
+            auto result = ntp_query(token, address, snap);
+            if (result) {
+                ++responses;
+                corrections.push_back({
+                        result->correction,
+                        result->latency,
+                        lan_addresses.contains(address),
+                        result->stratum,
+                        address.ip
+                    });
+                notify::log("%s: correction = %s, latency = %s",
+                            to_string(address).data(),
+                            seconds_to_human(result->correction, true).data(),
+                            seconds_to_human(result->latency).data());
+                continue;
+            }
+
+            if (result.error().what == query_error::code::canceled)
+                throw canceled_error{};
+
+            notify::log("ERROR querying address %s: %s",
+                        to_string(address).data(),
+                        to_string(result.error()).data());
+            failures.push_back({
+                    .ip = address.ip,
+                    .lan = lan_addresses.contains(address),
+                    .stat = result.error().what == query_error::code::timeout
+                            ? history::status::timeout
+                            : history::status::error,
+                });
+        }
+
+        if (tz_thread.joinable()) {
+            tz_thread.join();
+            try {
+                if (tz_error)
+                    std::rethrow_exception(tz_error);
+                auto& [name, offset] = tz_value;
+                cfg::store_time_zone(name, offset, utc_minutes(offset));
+                if (offset != snap.utc_offset) {
+                    // The corrections were measured using the old offset.
+                    for (auto& c : corrections)
+                        c.correction += offset - snap.utc_offset;
+                    snap.utc_offset = offset;
+                    if (!silent)
+                        notify::info(notify::level::verbose,
+                                     "Updated time zone to %s (%s)",
+                                     name.data(),
+                                     time_utils::tz_offset_to_string(offset).data());
+                }
             }
             catch (std::exception& e) {
-                logger::printf("ERROR querying address %s: %s\n",
-                               address_str.data(),
-                               e.what());
                 if (!silent)
                     notify::error(notify::level::verbose,
-                                  "%s: %s",
-                                  address_str.data(),
+                                  "Failed to update time zone: %s",
                                   e.what());
+                // NOTE: not a fatal error, we just keep using the previous time zone.
             }
         }
 
-        if (corrections.empty())
-            throw runtime_error{"No NTP server could be used!"};
+        // The corrections are final now, after any time zone change.
+        hist.add_servers(corrections, failures);
 
-        dbl_seconds total = std::accumulate(corrections.begin(),
-                                            corrections.end(),
-                                            dbl_seconds{0});
-        dbl_seconds avg = total / static_cast<double>(corrections.size());
+        /*
+         * The HTTP time is only accurate to about a second, and comes from a single
+         * unauthenticated response; it's only used as a fallback when NTP is blocked.
+         */
+        std::optional<http_estimate> http_time;
+        if (corrections.empty()) {
+            http_time = get_http_time(start, *servers, snap, token);
+            if (!http_time)
+                throw runtime_error{"No NTP server could be used!"};
+            logger::printf("HTTP time: correction = %s, uncertainty = %s\n",
+                           seconds_to_human(http_time->correction, true).data(),
+                           seconds_to_human(http_time->uncertainty).data());
+        }
 
-        if (abs(avg) <= cfg::tolerance.value) {
+        measurement result;
+        dbl_seconds tolerance = snap.tolerance;
+        if (http_time) {
+            result = {http_time->correction, http_time->uncertainty, false, 0};
+            hist.rec.src = history::source::http;
+            // Don't correct errors smaller than what the HTTP time can measure.
+            tolerance = std::max(tolerance, http_time->uncertainty);
+            if (!silent)
+                notify::info(notify::level::normal,
+                             "No NTP server could be used, using HTTP time (± %s).",
+                             seconds_to_human(http_time->uncertainty).data());
+        } else {
+            result = combine_corrections(corrections);
+            // A Date header seen during the sync can't veto NTP, it's only logged.
+            auto sample = http::last_date();
+            if (sample && sample->received >= start) {
+                auto estimate = estimate_from_date(*sample, snap.utc_offset);
+                if (abs(result.correction - estimate.correction) > estimate.uncertainty + 1s)
+                    logger::printf("WARNING: NTP correction %s disagrees with HTTP time"
+                                   " correction %s.\n",
+                                   seconds_to_human(result.correction, true).data(),
+                                   seconds_to_human(estimate.correction, true).data());
+            }
+        }
+        const dbl_seconds avg = result.correction;
+        const dbl_seconds tz_shift = snap.utc_offset - initial_offset;
+
+        if (!silent && !addresses.empty() && !corrections.empty())
+            notify::info(notify::level::verbose,
+                         "%zu/%zu servers, median latency %s, correction %s",
+                         responses,
+                         addresses.size(),
+                         seconds_to_human(median_latency(corrections)).data(),
+                         seconds_to_human(avg, true).data());
+
+        hist.rec.correction_us = to_us(avg);
+
+        if (abs(avg) <= tolerance) {
+            publish_state(result, avg, tz_shift);
+            hist.rec.result = history::outcome::tolerated;
             if (!silent)
                 notify::success(notify::level::verbose,
                                 "Tolerating clock drift (correction is only %s).",
@@ -418,6 +1044,9 @@ namespace core {
         if (!apply_clock_correction(avg))
             throw runtime_error{"Failed to set system clock!"};
 
+        publish_state(result, 0s, tz_shift);
+        hist.rec.result = history::outcome::corrected;
+
         if (!silent)
             notify::success(notify::level::normal,
                             "Clock corrected by %s",
@@ -434,6 +1063,8 @@ namespace core {
 
     namespace background {
 
+        using clock = std::chrono::steady_clock;
+
         std::stop_source stopper{std::nostopstate};
 
         enum class state_t : unsigned {
@@ -444,32 +1075,188 @@ namespace core {
         };
         std::atomic<state_t> state{state_t::none};
 
+        // In seconds of `clock`, truncated to 32 bits; 64-bit atomics are not lock-free.
+        std::atomic<std::uint32_t> last_sync{0};
 
+        // Network changes don't trigger syncs more often than this.
+        constexpr std::chrono::minutes resync_interval{5};
+
+        // How often the watcher checks the network.
+        constexpr std::chrono::seconds watch_interval{15};
+
+
+        std::uint32_t
+        seconds_now()
+        {
+            using std::chrono::duration_cast;
+            using std::chrono::seconds;
+            return duration_cast<seconds>(clock::now().time_since_epoch()).count();
+        }
+
+
+        // Unsigned subtraction, so it still works after the counter wraps around.
+        bool
+        can_resync()
+        {
+            return seconds_now() - last_sync.load() >= resync_interval / 1s;
+        }
+
+
+        // Errors are only shown as notifications; cancellation is rethrown.
+        void
+        sync(std::stop_token token)
+        {
+            try {
+                core::run(token, false);
+            }
+            catch (canceled_error& e) {
+                throw;
+            }
+            catch (std::exception& e) {
+                notify::error(notify::level::normal, "%s", e.what());
+            }
+            last_sync = seconds_now();
+        }
+
+
+        /*
+         * Checks the automatic time zone against the embedded rules.
+         *
+         * Returns true if a DST change already happened, and the clock should be
+         * synchronized again to apply it. Otherwise, `wait` is shortened so the watcher
+         * wakes up right at the next change.
+         */
+        bool
+        tz_changed(std::chrono::milliseconds& wait)
+        {
+            using std::chrono::minutes;
+
+            auto snap = cfg::get_snapshot();
+            if (!snap.auto_tz)
+                return false;
+            auto zone = tz::find(snap.tz_name.data());
+            if (!zone)
+                return false;
+
+            const minutes now = utc_minutes(snap.utc_offset);
+            if (tz::offset_at(*zone, now) != snap.utc_offset)
+                return true;
+
+            if (auto next = tz::next_transition(*zone, now))
+                wait = std::min<std::chrono::milliseconds>(wait, *next - now);
+            return false;
+        }
+
+
+        // The watcher is only needed by these options.
+        bool
+        watch_enabled()
+        {
+            auto snap = cfg::get_snapshot();
+            return snap.sync_on_network || snap.auto_tz;
+        }
+
+
+        // Returns as soon as the network is usable, or `max_wait` passes.
         void
-        run(std::chrono::seconds delay)
+        wait_for_network(std::stop_token token,
+                         std::chrono::seconds max_wait)
         {
-            state = state_t::started;
+            const auto deadline = clock::now() + max_wait;
+            while (!utils::get_network_address() && clock::now() < deadline)
+                sleep_for(500ms, token);
+        }
+
+
+        /*
+         * Syncs again when the network reconnects, or changes to a different address.
+         * Changes that come too soon after the last sync are delayed, not dropped.
+         *
+         * Also syncs when the automatic time zone enters or leaves DST; if that sync
+         * fails, it's retried at the same rate as network changes.
+         *
+         * The network is only polled while sync_on_network is enabled; returns once both
+         * options are disabled.
+         */
+        void
+        watch_network(std::stop_token token)
+        {
+            bool polled = false;
+            std::optional<std::uint32_t> last_address;
+            bool pending = false;
+            while (watch_enabled()) {
+                std::chrono::milliseconds wait = watch_interval;
+                if (tz_changed(wait) && can_resync()) {
+                    logger::printf("Daylight saving time changed, synchronizing again.\n");
+                    sync(token);
+                    continue;
+                }
+
+                if (!cfg::get_snapshot().sync_on_network) {
+                    // Start over if it's enabled again.
+                    polled = pending = false;
+                    sleep_for(wait, token);
+                    continue;
+                }
+
+                if (polled)
+                    sleep_for(wait, token);
+
+                auto address = utils::get_network_address();
+                if (polled && address != last_address)
+                    pending = address.has_value();
+                last_address = address;
+                polled = true;
+
+                if (pending && can_resync()) {
+                    pending = false;
+                    logger::printf("Network changed, synchronizing again.\n");
+                    sync(token);
+                }
+            }
+        }
+
+
+        void
+        start(bool sync_first,
+              std::chrono::seconds max_wait)
+        {
+            if (cfg::get_snapshot().ntp_broadcast)
+                discovery::start_listener();
+            else
+                discovery::stop_listener();
+
+            // Only one thread watches; and none is needed if no option uses it.
+            if (!sync_first && (state == state_t::started || !watch_enabled()))
+                return;
+
+            // Watching alone doesn't change whether the boot sync happened.
+            const state_t previous = state.exchange(state_t::started);
+            const state_t done = sync_first ? state_t::finished : previous;
 
             std::jthread t{
                 [](std::stop_token token,
-                   std::chrono::seconds delay)
+                   bool sync_first,
+                   std::chrono::seconds max_wait,
+                   state_t done)
                 {
                     wups::logger::guard logger_guard;
-
+                    state_t result = sync_first ? state_t::canceled : done;
                     try {
-                        sleep_for(delay, token);
-                        core::run(token, false);
-                        state = state_t::finished;
+                        if (sync_first) {
+                            wait_for_network(token, max_wait);
+                            sync(token);
+                            result = done;
+                        }
+                        watch_network(token);
                     }
                     catch (canceled_error& e) {
-                        state = state_t::canceled;
-                    }
-                    catch (std::exception& e) {
-                        notify::error(notify::level::normal, "%s", e.what());
-                        state = state_t::finished;
                     }
+                    state = result;
                 },
-                delay};
+                sync_first,
+                max_wait,
+                done};
 
             stopper = t.get_stop_source();
 
@@ -478,16 +1265,32 @@ namespace core {
 
 
         void
-        run_once(std::chrono::seconds delay)
+        run(std::chrono::seconds max_wait)
+        {
+            start(true, max_wait);
+        }
+
+
+        void
+        run_once(std::chrono::seconds max_wait)
+        {
+            // After the first sync, only watch for network changes.
+            start(state != state_t::finished, max_wait);
+        }
+
+
+        void
+        watch()
         {
-            if (state != state_t::finished)
-                run(delay);
+            start(false, 0s);
         }
 
 
         void
         stop()
         {
+            discovery::stop_listener();
+
             if (state == state_t::started) {
                 stopper.request_stop();
 
@@ -9,9 +9,12 @@
 #ifndef CORE_HPP
 #define CORE_HPP
 
+#include <cstdint>
+#include <expected>
 #include <stop_token>
 #include <string>
 
+#include "cfg.hpp"
 #include "net/address.hpp"
 #include "time_utils.hpp"
 
@@ -21,14 +24,48 @@ namespace core {
     using time_utils::dbl_seconds;
 
 
-    struct correction_latency_t {
+    struct sample {
         dbl_seconds correction;
         dbl_seconds latency;
+        std::uint8_t stratum;
     };
 
-    correction_latency_t
+
+    // Compact error from ntp_query(), only turned into a string when it's shown.
+    struct query_error {
+
+        enum class code : std::uint8_t {
+            canceled,
+            socket,
+            connect,
+            send,
+            send_retries,
+            poll,
+            poll_retries,
+            timeout,
+            recv,
+            short_packet,
+            bad_version,
+            bad_mode,
+            bad_leap,
+            origin_mismatch,
+            bad_timestamps,
+        };
+
+        code what;
+        int detail = 0; // errno, NTP version or NTP mode, depending on `what`
+
+    };
+
+    std::string
+    to_string(query_error e);
+
+
+    std::expected<sample, query_error>
     ntp_query(std::stop_token token,
-              net::address address);
+              net::address address,
+              const cfg::snapshot& snap)
+        noexcept;
 
 
     void
@@ -40,10 +77,19 @@ namespace core {
     local_clock_to_string();
 
 
+    /*
+     * The background thread waits up to `max_wait` for the network, syncs, and then keeps
+     * watching the network connection, to sync again when it changes. It only keeps
+     * watching while "sync_on_network" or "auto_tz" is enabled.
+     */
     namespace background {
 
-        void run(std::chrono::seconds delay);
-        void run_once(std::chrono::seconds delay);
+        void run(std::chrono::seconds max_wait);
+        // Only the first call syncs; later calls only watch the network.
+        void run_once(std::chrono::seconds max_wait);
+        // Only watches the network, without syncing first; does nothing if a thread
+        // is already running, or no option needs it.
+        void watch();
         void stop();
 
     } // namespace background
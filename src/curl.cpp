@@ -6,10 +6,16 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <exception>            // current_exception(), rethrow_exception()
+#include <stdexcept>            // length_error, logic_error, runtime_error
+#include <utility>              // move()
+
 #include <wupsxx/logger.hpp>
 
 #include "curl.hpp"
 
+#include "trace.hpp"
+
 
 namespace logger = wups::logger;
 
@@ -44,6 +50,70 @@ namespace curl {
 
 
 
+    void
+    check(CURLSHcode code)
+    {
+        if (code == CURLSHE_OK)
+            return;
+        throw std::runtime_error{curl_share_strerror(code)};
+    }
+
+
+    share::share() :
+        sh{curl_share_init()}
+    {
+        if (!sh)
+            throw std::logic_error{"curl share handle is null"};
+
+        check(curl_share_setopt(sh, CURLSHOPT_LOCKFUNC, &share::lock_callback));
+        check(curl_share_setopt(sh, CURLSHOPT_UNLOCKFUNC, &share::unlock_callback));
+        check(curl_share_setopt(sh, CURLSHOPT_USERDATA, this));
+    }
+
+
+    share::~share()
+    {
+        curl_share_cleanup(sh);
+    }
+
+
+    void
+    share::lock_callback(CURL* /*h*/,
+                         curl_lock_data data,
+                         curl_lock_access /*access*/,
+                         void* ctx)
+    {
+        auto s = static_cast<share*>(ctx);
+        s->mutexes[data].lock();
+    }
+
+
+    void
+    share::unlock_callback(CURL* /*h*/,
+                           curl_lock_data data,
+                           void* ctx)
+    {
+        auto s = static_cast<share*>(ctx);
+        s->mutexes[data].unlock();
+    }
+
+
+    void
+    share::share_data(curl_lock_data data)
+    {
+        check(curl_share_setopt(sh, CURLSHOPT_SHARE, data));
+    }
+
+
+    CURLSH*
+    share::get()
+        const noexcept
+    {
+        return sh;
+    }
+
+
+
     handle::handle() :
         h{curl_easy_init()}
     {
@@ -52,7 +122,8 @@ namespace curl {
 
 
     handle::handle(const handle& other) :
-        h{curl_easy_duphandle(other.h)}
+        h{curl_easy_duphandle(other.h)},
+        max_size{other.max_size}
     {
         init();
     }
@@ -76,6 +147,28 @@ namespace curl {
 
         check(curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, &handle::write_callback));
         check(curl_easy_setopt(h, CURLOPT_WRITEDATA, this));
+        check(curl_easy_setopt(h, CURLOPT_HEADERFUNCTION, &handle::header_callback));
+        check(curl_easy_setopt(h, CURLOPT_HEADERDATA, this));
+        check(curl_easy_setopt(h, CURLOPT_PRIVATE, this));
+    }
+
+
+    CURL*
+    handle::get()
+        const noexcept
+    {
+        return h;
+    }
+
+
+    handle*
+    handle::from(CURL* h)
+    {
+        void* ptr = nullptr;
+        check(curl_easy_getinfo(h, CURLINFO_PRIVATE, &ptr));
+        if (!ptr)
+            throw std::logic_error{"curl easy handle has no owner"};
+        return static_cast<handle*>(ptr);
     }
 
 
@@ -93,19 +186,132 @@ namespace curl {
         }
         catch (std::exception& e) {
             logger::printf("curl::handle::write_callback(): %s\n", e.what());
+            // Exceptions can't cross curl, so it's kept for whoever started the transfer.
+            if (h)
+                h->sink_error = std::current_exception();
             return CURL_WRITEFUNC_ERROR;
         }
     }
 
 
+    std::size_t
+    handle::header_callback(char* buffer,
+                            std::size_t /*size*/,
+                            std::size_t nmemb,
+                            void* ctx)
+    {
+        handle* h = static_cast<handle*>(ctx);
+        try {
+            if (!h)
+                throw std::logic_error{"null handle"};
+            return h->on_header(buffer, nmemb);
+        }
+        catch (std::exception& e) {
+            logger::printf("curl::handle::header_callback(): %s\n", e.what());
+            return CURL_WRITEFUNC_ERROR;
+        }
+    }
+
+
+    std::size_t
+    handle::on_header(const char* buffer, std::size_t size)
+    {
+        if (header_sink && !header_sink(std::string_view{buffer, size}))
+            return 0;
+        return size;
+    }
+
+
     std::size_t
     handle::on_recv(const char* buffer, std::size_t size)
     {
-        result.append(buffer, size);
+        received += size;
+        trace::add(trace::counter::bytes_received, size);
+        if (max_size && received > max_size)
+            throw std::length_error{"response is too large"};
+
+        if (!sink) {
+            result.append(buffer, size);
+            return size;
+        }
+
+        if (!sink(std::string_view{buffer, size})) {
+            sink_finished = true;
+            return 0; // makes curl abort the transfer
+        }
         return size;
     }
 
 
+    void
+    handle::set_sink(sink_type s)
+    {
+        sink = std::move(s);
+        result.clear();
+        received = 0;
+        sink_finished = false;
+        sink_error = nullptr;
+    }
+
+
+    bool
+    handle::stopped_by_sink()
+        const noexcept
+    {
+        return sink_finished;
+    }
+
+
+    void
+    handle::clear_sink()
+        noexcept
+    {
+        sink = nullptr;
+    }
+
+
+    std::exception_ptr
+    handle::take_sink_error()
+        noexcept
+    {
+        return std::exchange(sink_error, nullptr);
+    }
+
+
+    void
+    handle::set_max_size(std::size_t bytes)
+    {
+        max_size = bytes;
+    }
+
+
+    void
+    handle::set_header_sink(sink_type s)
+    {
+        header_sink = std::move(s);
+    }
+
+
+    std::chrono::microseconds
+    handle::get_pretransfer_time()
+        const
+    {
+        curl_off_t t = 0;
+        check(curl_easy_getinfo(h, CURLINFO_PRETRANSFER_TIME_T, &t));
+        return std::chrono::microseconds{t};
+    }
+
+
+    std::chrono::microseconds
+    handle::get_starttransfer_time()
+        const
+    {
+        curl_off_t t = 0;
+        check(curl_easy_getinfo(h, CURLINFO_STARTTRANSFER_TIME_T, &t));
+        return std::chrono::microseconds{t};
+    }
+
+
     void
     handle::setopt(CURLoption option, bool arg)
     {
@@ -121,6 +327,13 @@ namespace curl {
     }
 
 
+    void
+    handle::setopt(CURLoption option, share& arg)
+    {
+        check(curl_easy_setopt(h, option, arg.get()));
+    }
+
+
     // convenience setters
 
     void
@@ -130,6 +343,29 @@ namespace curl {
     }
 
 
+    void
+    handle::set_nobody(bool enable)
+    {
+        setopt(CURLOPT_NOBODY, enable);
+        if (!enable)
+            setopt(CURLOPT_HTTPGET, true);
+    }
+
+
+    void
+    handle::set_share(share& sh)
+    {
+        setopt(CURLOPT_SHARE, sh);
+    }
+
+
+    void
+    handle::set_tcp_keepalive(bool enable)
+    {
+        setopt(CURLOPT_TCP_KEEPALIVE, enable);
+    }
+
+
     void
     handle::set_url(const std::string& url)
     {
@@ -147,7 +383,90 @@ namespace curl {
     void
     handle::perform()
     {
-        check(curl_easy_perform(h));
+        auto code = curl_easy_perform(h);
+        if (auto e = take_sink_error())
+            std::rethrow_exception(e);
+        check(code);
+    }
+
+
+
+    void
+    check(CURLMcode code)
+    {
+        if (code == CURLM_OK)
+            return;
+        throw std::runtime_error{curl_multi_strerror(code)};
+    }
+
+
+    multi::multi() :
+        mh{curl_multi_init()}
+    {
+        if (!mh)
+            throw std::logic_error{"curl multi handle is null"};
+    }
+
+
+    multi::~multi()
+    {
+        curl_multi_cleanup(mh);
+    }
+
+
+    void
+    multi::add(handle& h)
+    {
+        check(curl_multi_add_handle(mh, h.get()));
+    }
+
+
+    void
+    multi::remove(handle& h)
+    {
+        check(curl_multi_remove_handle(mh, h.get()));
+    }
+
+
+    int
+    multi::perform()
+    {
+        int running = 0;
+        check(curl_multi_perform(mh, &running));
+        return running;
+    }
+
+
+    void
+    multi::poll(std::chrono::milliseconds timeout)
+    {
+        check(curl_multi_poll(mh, nullptr, 0, timeout.count(), nullptr));
+    }
+
+
+    void
+    multi::wakeup()
+        noexcept
+    {
+        if (auto code = curl_multi_wakeup(mh); code != CURLM_OK)
+            logger::printf("curl::multi::wakeup(): %s\n", curl_multi_strerror(code));
+    }
+
+
+    std::optional<std::pair<handle*, CURLcode>>
+    multi::info_read()
+    {
+        int remaining = 0;
+        while (CURLMsg* msg = curl_multi_info_read(mh, &remaining)) {
+            if (msg->msg == CURLMSG_DONE) {
+                handle* h = handle::from(msg->easy_handle);
+                CURLcode code = msg->data.result;
+                if (code == CURLE_WRITE_ERROR && h->stopped_by_sink())
+                    code = CURLE_OK;
+                return std::pair{h, code};
+            }
+        }
+        return {};
     }
 
 
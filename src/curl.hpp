@@ -9,9 +9,17 @@
 #ifndef CURL_HPP
 #define CURL_HPP
 
+#include <chrono>
+#include <cstddef>              // size_t
+#include <exception>            // exception_ptr
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <stdexcept>            // runtime_error
 #include <string>
+#include <string_view>
+#include <utility>              // pair<>
 
 #include <curl/curl.h>
 
@@ -36,11 +44,60 @@ namespace curl {
     };
 
 
+    // Data shared between easy handles: DNS cache, TLS sessions and connections.
+    class share {
+
+        CURLSH* sh;
+        std::mutex mutexes[CURL_LOCK_DATA_LAST];
+
+        static
+        void
+        lock_callback(CURL* h,
+                      curl_lock_data data,
+                      curl_lock_access access,
+                      void* ctx);
+
+        static
+        void
+        unlock_callback(CURL* h,
+                        curl_lock_data data,
+                        void* ctx);
+
+    public:
+
+        share();
+
+        share(const share&) = delete;
+
+        ~share();
+
+
+        void share_data(curl_lock_data data);
+
+        CURLSH* get() const noexcept;
+
+    };
+
+
     class handle {
 
+    public:
+
+        // Receives the body as it arrives; returns false to stop the transfer early.
+        using sink_type = std::function<bool(std::string_view chunk)>;
+
+    private:
+
         CURL* h;
         std::unique_ptr<char[]> error_buffer;
 
+        sink_type sink;
+        sink_type header_sink;
+        std::size_t max_size = 0;
+        std::size_t received = 0;
+        bool sink_finished = false;
+        std::exception_ptr sink_error;
+
         void init();
 
         // static int sockopt_callback(handle* h, curl_socket_t fd, curlsocktype purpose);
@@ -49,13 +106,20 @@ namespace curl {
         std::size_t
         write_callback(char* buffer, std::size_t size, std::size_t nmemb, void* ctx);
 
+        static
+        std::size_t
+        header_callback(char* buffer, std::size_t size, std::size_t nmemb, void* ctx);
+
     protected:
 
         virtual std::size_t on_recv(const char* buffer, std::size_t size);
 
+        virtual std::size_t on_header(const char* buffer, std::size_t size);
+
 
     public:
 
+        // The body goes here when there's no sink.
         std::string result;
 
 
@@ -66,13 +130,58 @@ namespace curl {
         ~handle();
 
 
+        CURL* get() const noexcept;
+
+        // Recover the handle object from a raw CURL pointer.
+        static
+        handle*
+        from(CURL* h);
+
+
         void setopt(CURLoption option, bool arg);
         void setopt(CURLoption option, const std::string& arg);
+        void setopt(CURLoption option, share& arg);
+
+
+        /*
+         * Sets where the body of the next transfer goes; when empty, it's appended to
+         * `result`. This also clears `result`, and restarts the size count.
+         */
+        void set_sink(sink_type s);
+
+        // True if the last transfer was stopped because the sink had enough data.
+        bool stopped_by_sink() const noexcept;
+
+        // Drops the sink, so it can't outlive what it refers to; `result` is kept.
+        void clear_sink() noexcept;
+
+        /*
+         * Returns what the sink threw during the last transfer, if anything; curl only
+         * reports it as CURLE_WRITE_ERROR.
+         */
+        std::exception_ptr take_sink_error() noexcept;
+
+        // Transfers that receive more than this many bytes fail; 0 means no limit.
+        void set_max_size(std::size_t bytes);
+
+        // Receives each response header line, for all following transfers.
+        void set_header_sink(sink_type s);
+
+
+        // Time from the start until the request was about to be sent.
+        std::chrono::microseconds get_pretransfer_time() const;
+
+        // Time from the start until the first response byte arrived.
+        std::chrono::microseconds get_starttransfer_time() const;
 
 
         // convenience setters
 
         void set_followlocation(bool enable);
+        // When true, only the headers are requested (HEAD); otherwise it's a GET.
+        void set_nobody(bool enable);
+        void set_share(share& sh);
+        void set_tcp_keepalive(bool enable);
         void set_url(const std::string& url);
         void set_useragent(const std::string& agent);
 
@@ -80,6 +189,49 @@ namespace curl {
 
     };
 
+
+    // Non-blocking transfers, through the multi interface.
+    class multi {
+
+        CURLM* mh;
+
+    public:
+
+        multi();
+
+        multi(const multi&) = delete;
+
+        ~multi();
+
+
+        void add(handle& h);
+
+        void remove(handle& h);
+
+
+        // Returns how many transfers are still running.
+        int perform();
+
+        // Wait for activity on any transfer, or until the timeout.
+        void poll(std::chrono::milliseconds timeout);
+
+        /*
+         * Makes a blocked poll() return early; safe to call from any thread, including
+         * stop callbacks. Errors are only logged: poll() then waits for its timeout.
+         */
+        void wakeup() noexcept;
+
+
+        /*
+         * Returns a finished transfer and its result, if there's any.
+         *
+         * NOTE: transfers stopped by their sink are reported as CURLE_OK.
+         */
+        std::optional<std::pair<handle*, CURLcode>>
+        info_read();
+
+    };
+
 } // namespace curl
 
 
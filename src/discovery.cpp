@@ -0,0 +1,250 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <algorithm>            // ranges::find()
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <stdexcept>            // runtime_error
+#include <thread>
+
+#include <coreinit/time.h>      // OSGetSystemTime()
+#include <nn/ac.h>
+
+#include <wupsxx/logger.hpp>
+
+#include "discovery.hpp"
+
+#include "net/socket.hpp"
+#include "ntp.hpp"
+#include "realtime.hpp"
+#include "utils.hpp"
+
+
+using namespace std::literals;
+
+namespace logger = wups::logger;
+
+
+namespace discovery {
+
+    namespace {
+
+        using clock = std::chrono::steady_clock;
+
+
+        struct cache_entry {
+            net::ipv4_t subnet = 0;
+            clock::time_point when;
+            std::vector<net::address> servers;
+        };
+
+        std::mutex cache_mutex;
+        std::optional<cache_entry> cache;
+
+
+        // Returns the local address and the subnet mask.
+        std::pair<net::ipv4_t, net::ipv4_t>
+        get_local_network()
+        {
+            std::uint32_t ip = 0;
+            std::uint32_t mask = 0;
+            if (!nn::ac::GetAssignedAddress(&ip) || !nn::ac::GetAssignedSubnet(&mask))
+                throw std::runtime_error{"Could not get the local network address."};
+            return {ip, mask};
+        }
+
+
+        std::vector<net::address>
+        broadcast_query(net::address target,
+                        net::ipv4_t local_ip,
+                        std::stop_token token,
+                        std::chrono::milliseconds window)
+        {
+            net::socket sock = net::socket::make_udp();
+            sock.set_broadcast(true);
+
+            /*
+             * The transmit time is only used to match the responses, so it doesn't need
+             * to be the actual time; the ticks since boot mixed with our address are
+             * unlikely to be confused with stray packets, or with another console's query.
+             */
+            ntp::packet request;
+            request.version(4);
+            request.mode(ntp::packet::mode_flag::client);
+            request.transmit_time.store(static_cast<std::uint64_t>(OSGetSystemTime())
+                                        ^ (std::uint64_t{local_ip} << 32));
+
+            sock.sendto(&request, sizeof request, target);
+
+            std::vector<net::address> result;
+            const auto deadline = clock::now() + window;
+            for (auto now = clock::now(); now < deadline; now = clock::now()) {
+                if (token.stop_requested())
+                    break;
+                auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+                if (!sock.is_readable(remaining))
+                    break;
+
+                ntp::packet response;
+                auto [size, from] = sock.recvfrom(&response, sizeof response);
+                if (size < sizeof response
+                    || response.mode() != ntp::packet::mode_flag::server
+                    || response.origin_time != request.transmit_time
+                    || response.leap() == ntp::packet::leap_flag::unknown
+                    || !response.stratum)
+                    continue;
+
+                if (std::ranges::find(result, from) == result.end()) {
+                    logger::printf("Found LAN NTP server: %s (stratum %u)\n",
+                                   to_string(from).data(),
+                                   unsigned{response.stratum});
+                    result.push_back(from);
+                }
+            }
+            return result;
+        }
+
+    } // namespace
+
+
+    std::vector<net::address>
+    get_lan_servers(std::stop_token token,
+                    std::chrono::milliseconds window,
+                    std::chrono::minutes max_age)
+    {
+        auto [ip, mask] = get_local_network();
+        const net::ipv4_t subnet = ip & mask;
+
+        {
+            std::lock_guard lock{cache_mutex};
+            if (cache && cache->subnet == subnet && clock::now() - cache->when < max_age)
+                return cache->servers;
+        }
+
+        const net::address broadcast{subnet | ~mask, 123};
+        auto servers = broadcast_query(broadcast, ip, token, window);
+
+        // Don't cache an interrupted search.
+        if (!token.stop_requested()) {
+            std::lock_guard lock{cache_mutex};
+            cache = cache_entry{subnet, clock::now(), servers};
+        }
+
+        return servers;
+    }
+
+
+    namespace {
+
+        std::mutex broadcast_mutex;
+        std::optional<broadcast> latest_broadcast;
+
+        std::jthread listener;
+
+
+        bool
+        valid(const broadcast& b, std::size_t size)
+            noexcept
+        {
+            const auto& p = b.packet;
+            auto v = p.version();
+            return size >= sizeof p
+                && v >= 3 && v <= 4
+                && p.mode() == ntp::packet::mode_flag::broadcast
+                && p.leap() != ntp::packet::leap_flag::unknown
+                && p.stratum
+                && p.transmit_time;
+        }
+
+
+        void
+        listen(std::stop_token token)
+        {
+            net::socket sock = net::socket::make_udp();
+            sock.set_reuseaddr(true);
+            sock.bind(net::address{INADDR_ANY, 123});
+
+            // Mostly blocked, but when a packet arrives it's timestamped right away.
+            realtime::guard rt_guard;
+
+            while (!token.stop_requested()) {
+                // Wake up periodically, to check for a stop request.
+                if (!sock.is_readable(500ms))
+                    continue;
+
+                broadcast result;
+                auto [size, from] = sock.recvfrom(&result.packet, sizeof result.packet);
+                // Measure the arrival time as soon as possible.
+                result.received_local = utc::now(0min).value;
+                result.received_steady = clock::now();
+                result.from = from;
+
+                if (!valid(result, size))
+                    continue;
+
+                std::lock_guard lock{broadcast_mutex};
+                latest_broadcast = result;
+            }
+        }
+
+    } // namespace
+
+
+    void
+    start_listener()
+    {
+        if (listener.joinable())
+            return;
+        listener = std::jthread{
+            [](std::stop_token token)
+            {
+                logger::guard logger_guard;
+                while (!token.stop_requested()) {
+                    try {
+                        utils::network_guard net_guard;
+                        listen(token);
+                    }
+                    catch (std::exception& e) {
+                        logger::printf("ERROR listening for NTP broadcasts: %s\n", e.what());
+                        // Try again in 10 seconds, the network may not be ready yet.
+                        for (int i = 0; i < 100 && !token.stop_requested(); ++i)
+                            std::this_thread::sleep_for(100ms);
+                    }
+                }
+            }};
+    }
+
+
+    void
+    stop_listener()
+        noexcept
+    {
+        listener = {};
+    }
+
+
+    std::optional<broadcast>
+    last_broadcast(std::chrono::seconds max_age)
+    {
+        std::lock_guard lock{broadcast_mutex};
+        if (latest_broadcast && clock::now() - latest_broadcast->received_steady <= max_age)
+            return latest_broadcast;
+        return {};
+    }
+
+
+    void
+    forget_broadcast()
+        noexcept
+    {
+        std::lock_guard lock{broadcast_mutex};
+        latest_broadcast.reset();
+    }
+
+} // namespace discovery
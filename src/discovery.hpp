@@ -0,0 +1,67 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef DISCOVERY_HPP
+#define DISCOVERY_HPP
+
+#include <chrono>
+#include <optional>
+#include <stop_token>
+#include <vector>
+
+#include "net/address.hpp"
+#include "ntp.hpp"
+#include "utc.hpp"
+
+
+namespace discovery {
+
+    /*
+     * NTP servers in the local network, found by broadcasting a NTP request to the
+     * subnet. The result is reused until the subnet changes or `max_age` passes.
+     *
+     * Throws on network errors.
+     */
+    std::vector<net::address>
+    get_lan_servers(std::stop_token token,
+                    std::chrono::milliseconds window,
+                    std::chrono::minutes max_age = std::chrono::hours{1});
+
+
+    // A NTP broadcast (mode 5) packet, and when it arrived.
+    struct broadcast {
+        net::address          from;
+        ntp::packet           packet;
+        // Local clock at arrival, without the UTC offset, which may change later.
+        utc::dbl_seconds      received_local;
+        std::chrono::steady_clock::time_point received_steady;
+    };
+
+    /*
+     * Keeps listening on UDP port 123 for NTP broadcasts, in a background thread, so a
+     * sync can use the last one heard without waiting. Nothing is sent out.
+     */
+    void
+    start_listener();
+
+    void
+    stop_listener()
+        noexcept;
+
+    // The most recent broadcast heard, unless it's older than `max_age`.
+    std::optional<broadcast>
+    last_broadcast(std::chrono::seconds max_age);
+
+    // Discards the last broadcast heard; its arrival time is invalid after a clock change.
+    void
+    forget_broadcast()
+        noexcept;
+
+} // namespace discovery
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <utility>              // move()
+
+#include <wupsxx/logger.hpp>
+
+#include "export_item.hpp"
+
+
+namespace logger = wups::logger;
+
+
+export_item::export_item(const std::string& label,
+                         exporter_type exporter) :
+    button_item{label},
+    exporter{std::move(exporter)}
+{}
+
+
+std::unique_ptr<export_item>
+export_item::create(const std::string& label,
+                    exporter_type exporter)
+{
+    return std::make_unique<export_item>(label, std::move(exporter));
+}
+
+
+void
+export_item::on_started()
+{
+    status_msg = "Exporting...";
+
+    auto task = [this]
+    {
+        try {
+            auto path = exporter();
+            current_state = state::stopped;
+            return path;
+        }
+        catch (std::exception& e) {
+            current_state = state::stopped;
+            throw;
+        }
+    };
+
+    task_result = std::async(std::launch::async, std::move(task));
+}
+
+
+void
+export_item::on_finished()
+{
+    try {
+        status_msg = "Saved to " + task_result.get();
+    }
+    catch (std::exception& e) {
+        logger::printf("ERROR: %s\n", e.what());
+        status_msg = e.what();
+    }
+}
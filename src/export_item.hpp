@@ -0,0 +1,53 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef EXPORT_ITEM_HPP
+#define EXPORT_ITEM_HPP
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+
+#include <wupsxx/button_item.hpp>
+
+
+// Button that writes a file to the SD card, in the background.
+struct export_item : wups::button_item {
+
+    // Writes the file, and returns its path; throws on errors.
+    using exporter_type = std::function<std::string()>;
+
+    exporter_type exporter;
+    std::future<std::string> task_result;
+
+
+    export_item(const std::string& label,
+                exporter_type exporter);
+
+
+    static
+    std::unique_ptr<export_item>
+    create(const std::string& label,
+           exporter_type exporter);
+
+
+    virtual
+    void
+    on_started()
+        override;
+
+
+    virtual
+    void
+    on_finished()
+        override;
+
+};
+
+#endif
@@ -0,0 +1,307 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>               // FILE, fopen(), fprintf(), fread(), fwrite()
+#include <memory>               // unique_ptr<>
+#include <mutex>
+#include <stdexcept>            // runtime_error
+#include <system_error>         // errc, make_error_code()
+#include <vector>
+
+#include <wupsxx/logger.hpp>
+
+#include "history.hpp"
+
+
+using namespace std::literals;
+
+namespace logger = wups::logger;
+
+
+namespace history {
+
+    namespace {
+
+        struct header {
+            std::uint32_t magic    = 0x54534832; // "TSH2"
+            std::uint32_t rec_size = sizeof(record);
+            std::uint32_t capacity = history::capacity;
+            std::uint32_t next     = 0; // where the next record goes
+            std::uint32_t count    = 0;
+            std::uint32_t reserved = 0;
+
+            bool
+            valid()
+                const noexcept
+            {
+                const header expected;
+                return magic == expected.magic
+                    && rec_size == expected.rec_size
+                    && capacity == expected.capacity
+                    && next < capacity
+                    && count <= capacity;
+            }
+        };
+
+
+        // Records are written once this many are buffered, or on flush().
+        constexpr std::size_t batch_size = 4;
+
+        std::mutex history_mutex;
+        std::vector<record> pending;
+
+
+        using file_ptr = std::unique_ptr<std::FILE, int(*)(std::FILE*)>;
+
+
+        file_ptr
+        open_file(const char* path,
+                  const char* mode)
+        {
+            file_ptr f{std::fopen(path, mode), std::fclose};
+            if (!f)
+                throw std::runtime_error{"Could not open \""s + path + "\": "
+                                         + std::make_error_code(std::errc{errno}).message()};
+            return f;
+        }
+
+
+        // Opens the log, creating it if it's missing or has a different format.
+        file_ptr
+        open_log(header& hdr)
+        {
+            if (std::FILE* f = std::fopen(log_path, "r+b")) {
+                file_ptr file{f, std::fclose};
+                if (std::fread(&hdr, sizeof hdr, 1, f) == 1 && hdr.valid())
+                    return file;
+            }
+            hdr = {};
+            return open_file(log_path, "w+b");
+        }
+
+
+        void
+        write_pending()
+        {
+            if (pending.empty())
+                return;
+
+            header hdr;
+            auto file = open_log(hdr);
+            std::FILE* f = file.get();
+
+            for (const auto& rec : pending) {
+                long pos = sizeof hdr + static_cast<long>(hdr.next) * sizeof rec;
+                if (std::fseek(f, pos, SEEK_SET) || std::fwrite(&rec, sizeof rec, 1, f) != 1)
+                    throw std::runtime_error{"Error writing to \""s + log_path + "\"."};
+                hdr.next = (hdr.next + 1) % capacity;
+                if (hdr.count < capacity)
+                    ++hdr.count;
+            }
+
+            // The header is only updated after the records are written.
+            if (std::fseek(f, 0, SEEK_SET) || std::fwrite(&hdr, sizeof hdr, 1, f) != 1)
+                throw std::runtime_error{"Error writing to \""s + log_path + "\"."};
+
+            pending.clear();
+        }
+
+
+        std::vector<record>
+        read_all()
+        {
+            header hdr;
+            auto file = open_log(hdr);
+            std::FILE* f = file.get();
+
+            std::vector<record> result(hdr.count);
+            const std::uint32_t first = (hdr.next + capacity - hdr.count) % capacity;
+            for (std::uint32_t i = 0; i < hdr.count; ++i) {
+                long pos = sizeof hdr + static_cast<long>((first + i) % capacity) * sizeof(record);
+                if (std::fseek(f, pos, SEEK_SET)
+                    || std::fread(&result[i], sizeof(record), 1, f) != 1)
+                    throw std::runtime_error{"Error reading \""s + log_path + "\"."};
+            }
+            return result;
+        }
+
+
+        // As "YYYY-MM-DD hh:mm:ss".
+        std::string
+        time_to_string(std::int64_t time_us)
+        {
+            using namespace std::chrono;
+            constexpr sys_days wiiu_epoch{year{2000} / 1 / 1};
+
+            sys_seconds t = wiiu_epoch + floor<seconds>(microseconds{time_us});
+            auto day = floor<days>(t);
+            year_month_day ymd{day};
+            hh_mm_ss hms{t - day};
+
+            char buf[32];
+            std::snprintf(buf, sizeof buf, "%04d-%02u-%02u %02d:%02d:%02d",
+                          static_cast<int>(ymd.year()),
+                          static_cast<unsigned>(ymd.month()),
+                          static_cast<unsigned>(ymd.day()),
+                          static_cast<int>(hms.hours().count()),
+                          static_cast<int>(hms.minutes().count()),
+                          static_cast<int>(hms.seconds().count()));
+            return buf;
+        }
+
+
+        const char*
+        to_string(source s)
+            noexcept
+        {
+            switch (s) {
+            case source::ntp:
+                return "ntp";
+            case source::broadcast:
+                return "broadcast";
+            case source::http:
+                return "http";
+            default:
+                return "unknown";
+            }
+        }
+
+
+        const char*
+        to_string(outcome o)
+            noexcept
+        {
+            switch (o) {
+            case outcome::corrected:
+                return "corrected";
+            case outcome::tolerated:
+                return "tolerated";
+            case outcome::failed:
+                return "failed";
+            case outcome::canceled:
+                return "canceled";
+            default:
+                return "unknown";
+            }
+        }
+
+
+        const char*
+        to_string(status s)
+            noexcept
+        {
+            switch (s) {
+            case status::ok:
+                return "ok";
+            case status::timeout:
+                return "timeout";
+            case status::error:
+                return "error";
+            default:
+                return "unknown";
+            }
+        }
+
+    } // namespace
+
+
+    void
+    record::add(const server& s)
+        noexcept
+    {
+        if (num_servers < servers.size())
+            servers[num_servers++] = s;
+    }
+
+
+    void
+    append(const record& r)
+        noexcept
+    {
+        try {
+            std::lock_guard lock{history_mutex};
+            if (pending.size() < capacity)
+                pending.push_back(r);
+            if (pending.size() >= batch_size)
+                write_pending();
+        }
+        catch (std::exception& e) {
+            logger::printf("ERROR in history::append(): %s\n", e.what());
+        }
+    }
+
+
+    void
+    flush()
+        noexcept
+    {
+        try {
+            std::lock_guard lock{history_mutex};
+            write_pending();
+        }
+        catch (std::exception& e) {
+            logger::printf("ERROR in history::flush(): %s\n", e.what());
+        }
+    }
+
+
+    std::string
+    export_csv()
+    {
+        std::vector<record> records;
+        {
+            std::lock_guard lock{history_mutex};
+            write_pending();
+            records = read_all();
+        }
+
+        auto file = open_file(csv_path, "w");
+        std::FILE* f = file.get();
+
+        std::fprintf(f, "time_utc,correction_ms,outcome,source,"
+                        "server,status,offset_ms,delay_ms,stratum,lan\n");
+        for (const auto& rec : records) {
+            auto time_str = time_to_string(rec.time_us);
+            char prefix[96];
+            std::snprintf(prefix, sizeof prefix, "%s,%.3f,%s,%s",
+                          time_str.data(),
+                          rec.correction_us / 1000.0,
+                          to_string(rec.result),
+                          to_string(rec.src));
+
+            if (!rec.num_servers)
+                std::fprintf(f, "%s,,,,,,\n", prefix);
+            for (unsigned i = 0; i < rec.num_servers && i < rec.servers.size(); ++i) {
+                const server& s = rec.servers[i];
+                std::fprintf(f, "%s,%u.%u.%u.%u,%s,",
+                             prefix,
+                             static_cast<unsigned>((s.ip >> 24) & 0xff),
+                             static_cast<unsigned>((s.ip >> 16) & 0xff),
+                             static_cast<unsigned>((s.ip >> 8) & 0xff),
+                             static_cast<unsigned>(s.ip & 0xff),
+                             to_string(s.stat));
+                if (s.stat == status::ok)
+                    std::fprintf(f, "%.3f,%.3f,%u,%u\n",
+                                 s.offset_us / 1000.0,
+                                 s.delay_us / 1000.0,
+                                 static_cast<unsigned>(s.stratum),
+                                 static_cast<unsigned>(s.lan));
+                else
+                    std::fprintf(f, ",,,%u\n", static_cast<unsigned>(s.lan));
+            }
+        }
+
+        if (std::ferror(f))
+            throw std::runtime_error{"Error writing to \""s + csv_path + "\"."};
+
+        return csv_path;
+    }
+
+} // namespace history
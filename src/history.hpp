@@ -0,0 +1,101 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+
+/*
+ * A log of what each sync did, kept on the SD card as a ring of fixed-size binary
+ * records, so it never grows past `capacity` records. Records are buffered in memory
+ * and written in batches.
+ */
+namespace history {
+
+    enum class status : std::uint8_t {
+        ok,
+        timeout,
+        error,
+    };
+
+
+    // Only `ok` servers have a delay, offset and stratum.
+    struct server {
+        std::uint32_t ip = 0;           // IPv4, host byte order
+        std::uint32_t delay_us = 0;
+        std::int64_t  offset_us = 0;
+        std::uint8_t  stratum = 0;
+        std::uint8_t  lan = 0;
+        status        stat = status::ok;
+        std::uint8_t  reserved[5] = {};
+    };
+
+
+    enum class source : std::uint8_t {
+        ntp,
+        broadcast,
+        http,
+    };
+
+
+    enum class outcome : std::uint8_t {
+        corrected,
+        tolerated,                      // the correction was too small to apply
+        failed,
+        canceled,
+    };
+
+
+    // Every sync writes one record, even when it fails or is canceled.
+    struct record {
+        std::int64_t  time_us = 0;      // UTC, microseconds since 2000-01-01
+        std::int64_t  correction_us = 0;
+        source        src = source::ntp;
+        outcome       result = outcome::failed;
+        std::uint8_t  num_servers = 0;
+        std::uint8_t  reserved[5] = {};
+        std::array<server, 8> servers;
+
+        // Ignored when all server slots are used.
+        void
+        add(const server& s)
+            noexcept;
+    };
+
+    static_assert(sizeof(record) == 216);
+
+
+    inline constexpr std::uint32_t capacity = 1000;
+
+    inline constexpr const char* log_path =
+        "fs:/vol/external01/wiiu/time_sync_history.bin";
+
+    inline constexpr const char* csv_path =
+        "fs:/vol/external01/wiiu/time_sync_history.csv";
+
+
+    void
+    append(const record& r)
+        noexcept;
+
+    // Writes out the buffered records.
+    void
+    flush()
+        noexcept;
+
+    // Writes the whole history as CSV, one row per server; returns the path.
+    std::string
+    export_csv();
+
+} // namespace history
+
+#endif
@@ -6,6 +6,21 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <algorithm>            // min(), ranges::find()
+#include <array>
+#include <cctype>               // tolower()
+#include <charconv>             // from_chars()
+#include <exception>            // rethrow_exception()
+#include <memory>               // make_unique(), unique_ptr<>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>            // runtime_error
+#include <system_error>         // errc
+#include <utility>              // move()
+
+#include <wupsxx/logger.hpp>
+
 #include "http_client.hpp"
 
 #include "curl.hpp"
@@ -14,22 +29,430 @@
 #include <config.h>
 #endif
 
+
+using namespace std::literals;
+
+namespace logger = wups::logger;
+
+
 namespace http {
 
+    namespace {
+
+        using clock = std::chrono::steady_clock;
+
+
+        std::optional<int>
+        parse_int(std::string_view str)
+        {
+            int value = 0;
+            auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+            if (ec != std::errc{} || ptr != str.data() + str.size())
+                return {};
+            return value;
+        }
+
+
+        // Parses the IMF-fixdate format, "Sun, 06 Nov 1994 08:49:37 GMT" (RFC 9110).
+        std::optional<std::chrono::sys_seconds>
+        parse_http_date(std::string_view str)
+        {
+            using namespace std::chrono;
+
+            constexpr std::array<std::string_view, 12> month_names = {
+                "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+            };
+
+            // 0         1         2
+            // 0123456789012345678901234567890
+            // Sun, 06 Nov 1994 08:49:37 GMT
+            if (str.size() != 29 || str.substr(25) != " GMT")
+                return {};
+
+            auto d  = parse_int(str.substr(5, 2));
+            auto y  = parse_int(str.substr(12, 4));
+            auto hh = parse_int(str.substr(17, 2));
+            auto mm = parse_int(str.substr(20, 2));
+            auto ss = parse_int(str.substr(23, 2));
+            auto m_it = std::ranges::find(month_names, str.substr(8, 3));
+            if (!d || !y || !hh || !mm || !ss || m_it == month_names.end())
+                return {};
+
+            const unsigned m = m_it - month_names.begin() + 1;
+            const year_month_day date{year{*y}, month{m}, day(*d)};
+            if (!date.ok() || *hh > 23 || *mm > 59 || *ss > 60)
+                return {};
+
+            return sys_days{date} + hours{*hh} + minutes{*mm} + seconds{*ss};
+        }
+
+
+        std::mutex date_mutex;
+        std::optional<date_sample> latest_date;
+
+
+        // Looks for the "Date" header in every response.
+        bool
+        harvest_date(const curl::handle& h,
+                     std::string_view line)
+        {
+            constexpr std::string_view key = "date:";
+            if (line.size() < key.size())
+                return true;
+            for (std::size_t i = 0; i < key.size(); ++i)
+                if (std::tolower(static_cast<unsigned char>(line[i])) != key[i])
+                    return true;
+
+            const auto received = clock::now();
+
+            line.remove_prefix(key.size());
+            while (!line.empty() && (line.front() == ' ' || line.front() == '\t'))
+                line.remove_prefix(1);
+            while (!line.empty() && (line.back() == '\r' || line.back() == '\n'))
+                line.remove_suffix(1);
+
+            auto server_time = parse_http_date(line);
+            if (!server_time)
+                return true; // not an error, the header is just not useful
+
+            auto rtt = h.get_starttransfer_time() - h.get_pretransfer_time();
+
+            std::lock_guard lock{date_mutex};
+            latest_date = date_sample{*server_time, received, rtt};
+            return true;
+        }
+
+
+        /*
+         * Long-lived state, so repeated requests can reuse the DNS cache, open
+         * connections and TLS sessions, instead of starting from scratch.
+         *
+         * NOTE: members are destroyed in reverse order, so the easy handles go before
+         * the share, and curl_global_cleanup() runs last.
+         */
+        struct session {
+
+            curl::global global;
+            curl::share share;
+            curl::multi multi;
+            std::vector<std::unique_ptr<curl::handle>> handles;
+
+
+            session()
+            {
+                share.share_data(CURL_LOCK_DATA_DNS);
+                share.share_data(CURL_LOCK_DATA_SSL_SESSION);
+                share.share_data(CURL_LOCK_DATA_CONNECT);
+            }
+
+
+            // Returns the i-th pooled handle, creating it if needed.
+            curl::handle&
+            get_handle(std::size_t i)
+            {
+                while (handles.size() <= i) {
+                    auto h = std::make_unique<curl::handle>();
+                    h->set_share(share);
+                    h->set_useragent(PACKAGE_NAME "/" PACKAGE_VERSION " (Wii U; Aroma)");
+                    h->set_followlocation(true);
+                    h->set_tcp_keepalive(true);
+                    h->set_max_size(max_body_size);
+                    h->set_header_sink([hp = h.get()](std::string_view line)
+                                       {
+                                           return harvest_date(*hp, line);
+                                       });
+                    handles.push_back(std::move(h));
+                }
+                return *handles[i];
+            }
+
+        };
+
+
+        std::mutex session_mutex;
+        std::unique_ptr<session> current_session;
+
+
+        session&
+        get_session()
+        {
+            if (!current_session)
+                current_session = std::make_unique<session>();
+            return *current_session;
+        }
+
+
+        /*
+         * RAII type to keep easy handles inside a multi handle.
+         *
+         * The sinks usually refer to the caller's locals, so they're dropped when the
+         * transfer ends, instead of staying in the pooled handles.
+         */
+        struct transfer_guard {
+
+            curl::multi& multi;
+            std::span<curl::handle* const> handles;
+
+            transfer_guard(curl::multi& m,
+                           std::span<curl::handle* const> hs) :
+                multi(m),
+                handles(hs)
+            {
+                for (auto h : handles)
+                    multi.add(*h);
+            }
+
+            ~transfer_guard()
+            {
+                // NOTE: removing a handle that is still running aborts its transfer.
+                for (auto h : handles) {
+                    try {
+                        multi.remove(*h);
+                    }
+                    catch (std::exception& e) {
+                        logger::printf("Failed to remove curl handle: %s\n", e.what());
+                    }
+                    h->clear_sink();
+                }
+            }
+
+        };
+
+
+        /*
+         * Runs the transfers concurrently, calling `on_done(handle, code)` as each one
+         * finishes, until `on_done` returns true, or all transfers finish.
+         *
+         * Returns false if the deadline was reached first.
+         */
+        template<typename F>
+        bool
+        perform_all(curl::multi& multi,
+                    std::span<curl::handle* const> handles,
+                    std::stop_token token,
+                    clock::time_point deadline,
+                    F on_done)
+        {
+            transfer_guard transfer{multi, handles};
+
+            // Don't wait for the poll timeout when a stop is requested.
+            std::stop_callback waker{token, [&multi] { multi.wakeup(); }};
+
+            for (;;) {
+                int running = multi.perform();
+                while (auto done = multi.info_read())
+                    if (on_done(*done->first, done->second))
+                        return true;
+                if (!running)
+                    return true;
+                if (token.stop_requested())
+                    throw std::runtime_error{"HTTP request canceled."};
+                auto remaining = deadline - clock::now();
+                if (remaining <= 0s)
+                    return false;
+                auto wait = std::chrono::ceil<std::chrono::milliseconds>(remaining);
+                multi.poll(std::min<std::chrono::milliseconds>(wait, 1s));
+            }
+        }
+
+
+        // What the sink threw, if it did; otherwise curl's message for `code`.
+        std::string
+        error_message(curl::handle& h,
+                      CURLcode code)
+        {
+            if (auto e = h.take_sink_error()) {
+                try {
+                    std::rethrow_exception(e);
+                }
+                catch (std::exception& ex) {
+                    return ex.what();
+                }
+            }
+            return curl_easy_strerror(code);
+        }
+
+    } // namespace
+
+
+    void
+    get(const std::string& url,
+        const sink& on_data,
+        std::stop_token token,
+        std::chrono::milliseconds timeout)
+    {
+        std::lock_guard lock{session_mutex};
+
+        auto& sess = get_session();
+        auto* handle = &sess.get_handle(0);
+        handle->set_nobody(false);
+        handle->set_sink(on_data);
+        handle->set_url(url);
+
+        std::optional<CURLcode> result;
+        bool finished = perform_all(sess.multi,
+                                    {&handle, 1},
+                                    token,
+                                    clock::now() + timeout,
+                                    [&result](curl::handle&, CURLcode code)
+                                    {
+                                        result = code;
+                                        return true;
+                                    });
+        // A parser error is more useful than CURLE_WRITE_ERROR.
+        if (auto e = handle->take_sink_error())
+            std::rethrow_exception(e);
+        if (!finished)
+            throw curl::error{CURLE_OPERATION_TIMEDOUT};
+        if (!result)
+            throw std::logic_error{"HTTP transfer finished without a result."};
+        if (*result != CURLE_OK)
+            throw curl::error{*result};
+    }
+
+
     std::string
-    get(const std::string& url)
+    get(const std::string& url,
+        std::stop_token token,
+        std::chrono::milliseconds timeout)
     {
-        curl::global guard;
+        std::string body;
+        get(url,
+            [&body](std::string_view chunk)
+            {
+                body.append(chunk);
+                return true;
+            },
+            token,
+            timeout);
+        return body;
+    }
 
-        curl::handle handle;
 
-        handle.set_useragent(PACKAGE_NAME "/" PACKAGE_VERSION " (Wii U; Aroma)");
-        handle.set_followlocation(true);
-        handle.set_url(url);
+    race_result
+    race(const std::vector<std::string>& urls,
+         const std::function<bool(std::size_t idx, std::string_view chunk)>& on_data,
+         const std::function<bool(std::size_t idx)>& accept,
+         std::stop_token token,
+         std::chrono::milliseconds timeout)
+    {
+        std::lock_guard lock{session_mutex};
 
-        handle.perform();
+        auto& sess = get_session();
 
-        return handle.result;
+        std::vector<curl::handle*> handles;
+        for (std::size_t i = 0; i < urls.size(); ++i) {
+            auto& h = sess.get_handle(i);
+            h.set_nobody(false);
+            h.set_sink([&on_data, i](std::string_view chunk)
+                       {
+                           return on_data(i, chunk);
+                       });
+            h.set_url(urls[i]);
+            handles.push_back(&h);
+        }
+
+        race_result result;
+        // Transfers that don't finish are charged with the full time the race took.
+        result.elapsed.assign(urls.size(), timeout);
+        result.failed.assign(urls.size(), false);
+
+        const auto start = clock::now();
+        perform_all(sess.multi,
+                    handles,
+                    token,
+                    start + timeout,
+                    [&](curl::handle& h, CURLcode code)
+                    {
+                        auto idx = std::ranges::find(handles, &h) - handles.begin();
+                        auto elapsed = clock::now() - start;
+                        result.elapsed[idx] = duration_cast<std::chrono::milliseconds>(elapsed);
+                        if (code != CURLE_OK) {
+                            logger::printf("HTTP request to %s failed: %s\n",
+                                           urls[idx].data(),
+                                           error_message(h, code).data());
+                            result.failed[idx] = true;
+                            return false;
+                        }
+                        if (!accept(idx)) {
+                            result.failed[idx] = true;
+                            return false;
+                        }
+                        result.winner = idx;
+                        return true;
+                    });
+
+        if (result.winner) {
+            // The aborted ones took at least as long as the winner.
+            auto winner_time = result.elapsed[*result.winner];
+            for (std::size_t i = 0; i < handles.size(); ++i)
+                if (i != *result.winner && result.elapsed[i] == timeout)
+                    result.elapsed[i] = winner_time;
+        }
+
+        return result;
+    }
+
+
+    std::optional<date_sample>
+    last_date()
+    {
+        std::lock_guard lock{date_mutex};
+        return latest_date;
+    }
+
+
+    date_sample
+    get_date(const std::string& url,
+             std::stop_token token,
+             std::chrono::milliseconds timeout)
+    {
+        std::lock_guard lock{session_mutex};
+
+        auto& sess = get_session();
+        auto* handle = &sess.get_handle(0);
+        handle->set_nobody(true);
+        handle->set_sink({});
+        handle->set_url(url);
+
+        const auto start = clock::now();
+        std::optional<CURLcode> result;
+        bool finished = perform_all(sess.multi,
+                                    {&handle, 1},
+                                    token,
+                                    start + timeout,
+                                    [&result](curl::handle&, CURLcode code)
+                                    {
+                                        result = code;
+                                        return true;
+                                    });
+        handle->set_nobody(false);
+        if (!finished)
+            throw curl::error{CURLE_OPERATION_TIMEDOUT};
+        if (!result)
+            throw std::logic_error{"HTTP transfer finished without a result."};
+        if (*result != CURLE_OK)
+            throw curl::error{*result};
+
+        auto sample = last_date();
+        if (!sample || sample->received < start)
+            throw std::runtime_error{"No valid Date header in the response."};
+        return *sample;
+    }
+
+
+    void
+    finalize()
+        noexcept
+    {
+        try {
+            std::lock_guard lock{session_mutex};
+            current_session.reset();
+        }
+        catch (std::exception& e) {
+            logger::printf("http::finalize() failed: %s\n", e.what());
+        }
     }
 
 } // namespace http
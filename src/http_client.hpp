@@ -9,12 +9,81 @@
 #ifndef HTTP_CLIENT_HPP
 #define HTTP_CLIENT_HPP
 
+#include <chrono>
+#include <cstddef>              // size_t
+#include <functional>
+#include <optional>
+#include <stop_token>
 #include <string>
+#include <string_view>
+#include <vector>
 
 
 namespace http {
 
-    std::string get(const std::string& url);
+    // Responses larger than this are rejected.
+    constexpr std::size_t max_body_size = 64 * 1024;
+
+
+    // Receives the body in chunks, as it arrives; returns false once it has enough.
+    using sink = std::function<bool(std::string_view chunk)>;
+
+
+    // Throws if the request fails, the timeout is reached, or a stop is requested.
+    std::string
+    get(const std::string& url,
+        std::stop_token token = {},
+        std::chrono::milliseconds timeout = std::chrono::seconds{15});
+
+    // Like above, but the body is streamed into `on_data` instead of stored.
+    void
+    get(const std::string& url,
+        const sink& on_data,
+        std::stop_token token = {},
+        std::chrono::milliseconds timeout = std::chrono::seconds{15});
+
+    struct race_result {
+        std::optional<std::size_t> winner;
+        std::vector<std::chrono::milliseconds> elapsed; // for each request
+        std::vector<bool> failed; // finished with an error, or not accepted
+    };
+
+    /*
+     * Sends all requests concurrently, streaming each body into `on_data`. The first
+     * finished response that `accept` takes is the winner, and the remaining transfers
+     * are aborted. If no response is accepted before the timeout, there's no winner.
+     */
+    race_result
+    race(const std::vector<std::string>& urls,
+         const std::function<bool(std::size_t idx, std::string_view chunk)>& on_data,
+         const std::function<bool(std::size_t idx)>& accept,
+         std::stop_token token = {},
+         std::chrono::milliseconds timeout = std::chrono::seconds{15});
+
+
+    // The server's clock, from the "Date" header of a response.
+    struct date_sample {
+        std::chrono::sys_seconds server_time;  // truncated to seconds
+        std::chrono::steady_clock::time_point received;
+        std::chrono::microseconds rtt;         // from sending the request to the reply
+    };
+
+    // The most recent Date header from any request, if there was one.
+    std::optional<date_sample> last_date();
+
+    // Requests only the headers (HEAD), to get the Date header.
+    date_sample
+    get_date(const std::string& url,
+             std::stop_token token = {},
+             std::chrono::milliseconds timeout = std::chrono::seconds{15});
+
+
+    /*
+     * Closes the HTTP session and any open connection. Sockets don't survive the
+     * application that created them, so this is also called when the application exits;
+     * the next request starts a new session.
+     */
+    void finalize() noexcept;
 
 } // namespace http
 
@@ -7,13 +7,17 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <coreinit/time.h>
 #include <wups.h>
 
 #include <wupsxx/logger.hpp>
 
 #include "cfg.hpp"
 #include "core.hpp"
+#include "history.hpp"
+#include "http_client.hpp"
 #include "notify.hpp"
+#include "utils.hpp"
 
 #ifdef HAVE_CONFIG_H
 #include <config.h>
@@ -31,10 +35,34 @@ WUPS_USE_WUT_DEVOPTAB();
 WUPS_USE_STORAGE(PACKAGE_TARNAME);
 
 
+namespace {
+
+    // Logs how many ticks the enclosing scope took.
+    struct tick_report {
+
+        const char* what;
+        OSTime start = OSGetTime();
+
+        ~tick_report()
+        {
+            OSTime ticks = OSGetTime() - start;
+            wups::logger::printf("%s took %lld ticks (%lld us)\n",
+                                 what,
+                                 static_cast<long long>(ticks),
+                                 static_cast<long long>(OSTicksToMicroseconds(ticks)));
+        }
+
+    };
+
+} // namespace
+
+
+// Nothing heavy here: notifications and options are set up when first needed.
 INITIALIZE_PLUGIN()
 {
     wups::logger::set_prefix(PACKAGE_TARNAME);
     wups::logger::guard guard;
+    tick_report report{"INITIALIZE_PLUGIN()"};
     notify::initialize();
     cfg::init();
 }
@@ -42,19 +70,38 @@ INITIALIZE_PLUGIN()
 
 DEINITIALIZE_PLUGIN()
 {
+    wups::logger::guard guard;
+    tick_report report{"DEINITIALIZE_PLUGIN()"};
     core::background::stop();
+    utils::close_network();
+    history::flush();
+    http::finalize();
     notify::finalize();
 }
 
 
 ON_APPLICATION_START()
 {
+    cfg::load_once();
+    try {
+        notify::start_worker();
+    }
+    catch (std::exception& e) {
+        wups::logger::printf("Failed to start notification worker: %s\n", e.what());
+    }
     if (cfg::sync_on_boot.value)
-        core::background::run_once(cfg::sync_on_boot_delay.value);
+        core::background::run_once(cfg::sync_on_boot_max_wait.value);
+    else
+        core::background::watch();
 }
 
 
 ON_APPLICATION_REQUESTS_EXIT()
 {
     core::background::stop();
+    // Pooled HTTP connections use this application's sockets.
+    http::finalize();
+    utils::close_network();
+    history::flush();
+    notify::stop_worker();
 }
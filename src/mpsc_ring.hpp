@@ -0,0 +1,91 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MPSC_RING_HPP
+#define MPSC_RING_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>              // size_t, ptrdiff_t
+
+
+/*
+ * Bounded lock-free queue: any number of threads push, one thread pops.
+ *
+ * Each cell has a sequence number telling whose turn it is: a producer claims the cell
+ * at position `pos` when its sequence is `pos`, and publishes it by storing `pos + 1`;
+ * the consumer then hands it back to producers for the next lap with `pos + N`.
+ */
+template<typename T,
+         std::size_t N>
+class mpsc_ring {
+
+    struct cell {
+        std::atomic<std::size_t> seq;
+        T data;
+    };
+
+    std::array<cell, N> cells;
+    std::atomic<std::size_t> head = 0; // next position to push
+    std::size_t tail = 0;              // next position to pop, only used by the consumer
+
+public:
+
+    mpsc_ring()
+        noexcept
+    {
+        for (std::size_t i = 0; i < N; ++i)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    mpsc_ring(const mpsc_ring&) = delete;
+
+
+    // Calls `fill(T&)` on a free cell; returns false without calling it if full.
+    template<typename F>
+    bool
+    try_push(F&& fill)
+        noexcept
+    {
+        std::size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c = cells[pos % N];
+            std::size_t seq = c.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    fill(c.data);
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0)
+                return false;
+            else
+                pos = head.load(std::memory_order_relaxed);
+        }
+    }
+
+
+    // Calls `use(T&)` on the oldest cell; returns false if empty. Consumer only.
+    template<typename F>
+    bool
+    try_pop(F&& use)
+        noexcept
+    {
+        cell& c = cells[tail % N];
+        if (c.seq.load(std::memory_order_acquire) != tail + 1)
+            return false;
+        use(c.data);
+        c.seq.store(tail + N, std::memory_order_release);
+        ++tail;
+        return true;
+    }
+
+};
+
+#endif
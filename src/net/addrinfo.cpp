@@ -49,10 +49,11 @@ namespace net::addrinfo {
     }
 
 
-    std::vector<result>
-    lookup(const std::optional<std::string>& name,
-           const std::optional<std::string>& service,
-           std::optional<hints> opts)
+    std::pmr::vector<result>
+    lookup(std::optional<std::string_view> name,
+           std::optional<std::string_view> service,
+           std::optional<hints> opts,
+           std::pmr::memory_resource* mr)
     {
         ai_ptr info;
 
@@ -78,9 +79,17 @@ namespace net::addrinfo {
             }
         }
 
+        // getaddrinfo() needs null-terminated strings
+        std::optional<std::pmr::string> name_str;
+        if (name)
+            name_str.emplace(*name, mr);
+        std::optional<std::pmr::string> service_str;
+        if (service)
+            service_str.emplace(*service, mr);
+
         struct ::addrinfo* raw_result_ptr = nullptr;
-        int status = ::getaddrinfo(name ? name->c_str() : nullptr,
-                                   service ? service->c_str() : nullptr,
+        int status = ::getaddrinfo(name_str ? name_str->c_str() : nullptr,
+                                   service_str ? service_str->c_str() : nullptr,
                                    raw_hints_ptr,
                                    &raw_result_ptr);
         if (status)
@@ -88,7 +97,7 @@ namespace net::addrinfo {
 
         info.reset(raw_result_ptr);
 
-        std::vector<result> res;
+        std::pmr::vector<result> res(mr);
 
         // walk through the linked list
         for (auto a = info.get(); a; a = a->ai_next) {
@@ -100,7 +109,7 @@ namespace net::addrinfo {
             item.type = to_type(a->ai_socktype, a->ai_protocol);
             item.addr = address(a->ai_addr, a->ai_addrlen);
             if (a->ai_canonname)
-                item.canon_name = std::string(a->ai_canonname);
+                item.canon_name.emplace(a->ai_canonname, mr);
 
             res.push_back(std::move(item));
         }
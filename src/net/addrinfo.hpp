@@ -9,8 +9,10 @@
 #ifndef NET_ADDRINFO_HPP
 #define NET_ADDRINFO_HPP
 
+#include <memory_resource>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <netdb.h>
@@ -33,14 +35,16 @@ namespace net::addrinfo {
     struct result {
         socket::type type;
         address      addr;
-        std::optional<std::string> canon_name;
+        std::optional<std::pmr::string> canon_name;
     };
 
 
-    std::vector<result>
-    lookup(const std::optional<std::string>& name,
-           const std::optional<std::string>& service = {},
-           std::optional<hints> options = {});
+    // NOTE: all memory for the results is taken from `mr`.
+    std::pmr::vector<result>
+    lookup(std::optional<std::string_view> name,
+           std::optional<std::string_view> service = {},
+           std::optional<hints> options = {},
+           std::pmr::memory_resource* mr = std::pmr::get_default_resource());
 
 } // namespace net::addrinfo
 
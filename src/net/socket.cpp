@@ -146,6 +146,17 @@ namespace net {
     }
 
 
+    std::expected<socket, error>
+    socket::try_make_udp()
+        noexcept
+    {
+        int new_fd = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (new_fd == -1)
+            return std::unexpected{error{errno}};
+        return socket{new_fd};
+    }
+
+
     socket::operator bool()
         const noexcept
     {
@@ -838,6 +849,20 @@ namespace net {
     { setsockopt(tcp_option::nodelay, enable); }
 
 
+    std::expected<void, error>
+    socket::try_connect(address a)
+        noexcept
+    {
+        const auto raw_addr = a.data();
+        int status = ::connect(fd,
+                               reinterpret_cast<const sockaddr*>(&raw_addr),
+                               sizeof raw_addr);
+        if (status == -1)
+            return std::unexpected{error{errno}};
+        return {};
+    }
+
+
     std::expected<socket::poll_flags, error>
     socket::try_poll(poll_flags flags,
                      std::chrono::milliseconds timeout)
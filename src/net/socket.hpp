@@ -131,6 +131,10 @@ namespace net {
         static
         socket make_udp();
 
+        static
+        std::expected<socket, error>
+        try_make_udp() noexcept;
+
 
         // check if socket is valid
         explicit
@@ -291,6 +295,11 @@ namespace net {
         void set_nodelay(bool enable);
 
 
+        std::expected<void, error>
+        try_connect(address addr)
+            noexcept;
+
+
         std::expected<poll_flags, error>
         try_poll(poll_flags flags, std::chrono::milliseconds timeout = {})
             const noexcept;
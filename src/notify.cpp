@@ -6,14 +6,22 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdarg>
-#include <string>
+#include <cstdio>               // vsnprintf()
+#include <mutex>
+#include <thread>
 
 #include <wupsxx/logger.hpp>
 #include <wupsxx/notify.hpp>
 
 #include "notify.hpp"
 
+#include "mpsc_ring.hpp"
+#include "realtime.hpp"
+
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
@@ -29,22 +37,60 @@ namespace notify {
     level max_level = level::quiet;
 
 
+    namespace {
+
+        /*
+         * The notification module is only set up right before the first notification is
+         * shown, so plugin loading doesn't pay for it.
+         */
+        std::mutex setup_mutex;
+        bool enabled = false;
+        bool ready = false;
+        std::chrono::milliseconds duration{0};
+
+
+        // Returns false if notifications can't be shown.
+        bool
+        setup()
+            noexcept
+        {
+            std::lock_guard lock{setup_mutex};
+            if (!enabled)
+                return false;
+            if (ready)
+                return true;
+            try {
+                wups::notify::initialize(PACKAGE_NAME);
+
+                wups::notify::info::set_text_color(255, 255, 255, 255);
+                wups::notify::info::set_bg_color(32, 32, 160, 255);
+
+                wups::notify::error::set_text_color(255, 255, 255, 255);
+                wups::notify::error::set_bg_color(160, 32, 32, 255);
+
+                if (duration > 0ms) {
+                    wups::notify::info::set_duration(duration);
+                    wups::notify::error::set_duration(duration);
+                }
+                ready = true;
+            }
+            catch (std::exception& e) {
+                logger::printf("notify::initialize() failed: %s\n", e.what());
+                // Don't try again on every notification.
+                enabled = false;
+            }
+            return ready;
+        }
+
+    } // namespace
+
+
     void
     initialize()
         noexcept
     {
-        try {
-            wups::notify::initialize(PACKAGE_NAME);
-
-            wups::notify::info::set_text_color(255, 255, 255, 255);
-            wups::notify::info::set_bg_color(32, 32, 160, 255);
-
-            wups::notify::error::set_text_color(255, 255, 255, 255);
-            wups::notify::error::set_bg_color(160, 32, 32, 255);
-        }
-        catch (std::exception& e) {
-            logger::printf("notify::initialize() failed: %s\n", e.what());
-        }
+        std::lock_guard lock{setup_mutex};
+        enabled = true;
     }
 
 
@@ -52,7 +98,12 @@ namespace notify {
     finalize()
         noexcept
     {
-        wups::notify::finalize();
+        stop_worker();
+        std::lock_guard lock{setup_mutex};
+        if (ready)
+            wups::notify::finalize();
+        enabled = false;
+        ready = false;
     }
 
 
@@ -68,8 +119,224 @@ namespace notify {
     set_duration(std::chrono::milliseconds dur)
         noexcept
     {
-        wups::notify::info::set_duration(dur);
-        wups::notify::error::set_duration(dur);
+        std::lock_guard lock{setup_mutex};
+        duration = dur;
+        if (ready) {
+            wups::notify::info::set_duration(dur);
+            wups::notify::error::set_duration(dur);
+        }
+    }
+
+
+    namespace {
+
+        enum class kind : unsigned char {
+            error,
+            info,
+            log,
+            success,
+        };
+
+
+        // A message, already formatted; long messages are truncated.
+        struct record {
+            kind k;
+            bool show;
+            char text[118];
+        };
+
+
+        mpsc_ring<record, 64> queue;
+        std::atomic<bool> worker_running = false;
+        std::atomic<unsigned> dropped = 0;
+        std::jthread worker;
+
+        // Producers that may still push after seeing `worker_running`.
+        std::atomic<unsigned> posting = 0;
+
+        /*
+         * The worker sleeps until post() signals there's something to write. Producers
+         * only take the lock to wake it up, when `sleeping` says it's idle.
+         */
+        std::atomic<bool> sleeping = false;
+        std::mutex wake_mutex;
+        std::condition_variable_any wake_cv;
+        bool wake_pending = false;
+
+
+        void
+        wake_worker()
+            noexcept
+        {
+            // Pairs with the fence in the worker, so either it sees the new record, or
+            // we see it sleeping.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!sleeping.load() || !sleeping.exchange(false))
+                return;
+            {
+                std::lock_guard lock{wake_mutex};
+                wake_pending = true;
+            }
+            wake_cv.notify_one();
+        }
+
+
+        __attribute__(( __format__ (__printf__, 2, 3)))
+        void
+        show(kind k,
+             const char* fmt,
+             ...)
+        {
+            std::va_list args;
+            va_start(args, fmt);
+            try {
+                switch (k) {
+                case kind::error:
+                    wups::notify::error::vshow(fmt, args);
+                    break;
+                case kind::info:
+                case kind::log:
+                    wups::notify::info::vshow(fmt, args);
+                    break;
+                case kind::success:
+                    wups::notify::info::vshow(wups::color{255, 255, 255},
+                                              wups::color{32, 160, 32},
+                                              fmt,
+                                              args);
+                    break;
+                }
+            }
+            catch (std::exception& e) {
+                logger::printf("notification error: %s\n", e.what());
+            }
+            va_end(args);
+        }
+
+
+        void
+        write_out(const record& r)
+            noexcept
+        {
+            switch (r.k) {
+            case kind::error:
+                logger::printf("ERROR: %s\n", r.text);
+                break;
+            case kind::info:
+                logger::printf("INFO: %s\n", r.text);
+                break;
+            case kind::log:
+                logger::printf("%s\n", r.text);
+                break;
+            case kind::success:
+                logger::printf("SUCCESS: %s\n", r.text);
+                break;
+            }
+
+            if (r.show && setup())
+                show(r.k, "%s", r.text);
+        }
+
+
+        void
+        drain()
+            noexcept
+        {
+            while (queue.try_pop(write_out)) {}
+            if (unsigned n = dropped.exchange(0))
+                logger::printf("WARNING: %u log messages were dropped.\n", n);
+        }
+
+
+        void
+        post(kind k,
+             level lvl,
+             const char* fmt,
+             std::va_list args)
+            noexcept
+        {
+            /*
+             * The level only decides if the message is shown; it's always formatted,
+             * since every message goes to the log.
+             */
+            const bool show = k != kind::log && lvl <= max_level;
+
+            auto fill = [&](record& r)
+            {
+                r.k = k;
+                r.show = show;
+                std::vsnprintf(r.text, sizeof r.text, fmt, args);
+            };
+
+            ++posting;
+            if (worker_running) {
+                if (!queue.try_push(fill))
+                    ++dropped;
+                --posting;
+                wake_worker();
+                return;
+            }
+            --posting;
+
+            record r;
+            fill(r);
+            write_out(r);
+        }
+
+    } // namespace
+
+
+    void
+    start_worker()
+    {
+        if (worker_running)
+            return;
+        worker = std::jthread{
+            [](std::stop_token token)
+            {
+                logger::guard logger_guard;
+                realtime::lower_priority();
+                for (;;) {
+                    drain();
+
+                    sleeping = true;
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    // Records pushed before `sleeping` was set won't wake us up.
+                    drain();
+
+                    std::unique_lock lock{wake_mutex};
+                    if (!wake_cv.wait(lock, token, [] { return wake_pending; }))
+                        break;
+                    wake_pending = false;
+                }
+            }};
+        worker_running = true;
+    }
+
+
+    void
+    stop_worker()
+        noexcept
+    {
+        worker_running = false;
+        worker = {};
+        // Producers that saw the worker running may still be pushing.
+        while (posting)
+            std::this_thread::yield();
+        logger::guard logger_guard;
+        drain();
+    }
+
+
+    __attribute__(( __format__ (__printf__, 1, 2)))
+    void
+    log(const char* fmt,
+        ...)
+        noexcept
+    {
+        std::va_list args;
+        va_start(args, fmt);
+        post(kind::log, level::quiet, fmt, args);
+        va_end(args);
     }
 
 
@@ -80,27 +347,10 @@ namespace notify {
           ...)
         noexcept
     {
-        std::va_list logger_args;
-        va_start(logger_args, fmt);
-        try {
-            std::string logger_fmt = "ERROR: "s + fmt + "\n"s;
-            logger::vprintf(logger_fmt.data(), logger_args);
-        }
-        catch (...) {}
-        va_end(logger_args);
-
-        if (lvl > max_level)
-            return;
-
-        std::va_list notify_args;
-        va_start(notify_args, fmt);
-        try {
-            wups::notify::error::vshow(fmt, notify_args);
-        }
-        catch (std::exception& e) {
-            logger::printf("notification error: %s\n", e.what());
-        }
-        va_end(notify_args);
+        std::va_list args;
+        va_start(args, fmt);
+        post(kind::error, lvl, fmt, args);
+        va_end(args);
     }
 
 
@@ -111,27 +361,10 @@ namespace notify {
          ...)
         noexcept
     {
-        std::va_list logger_args;
-        va_start(logger_args, fmt);
-        try {
-            std::string logger_fmt = "INFO: "s + fmt + "\n"s;
-            logger::vprintf(logger_fmt.data(), logger_args);
-        }
-        catch (...) {}
-        va_end(logger_args);
-
-        if (lvl > max_level)
-            return;
-
-        std::va_list notify_args;
-        va_start(notify_args, fmt);
-        try {
-            wups::notify::info::vshow(fmt, notify_args);
-        }
-        catch (std::exception& e) {
-            logger::printf("notification error: %s\n", e.what());
-        }
-        va_end(notify_args);
+        std::va_list args;
+        va_start(args, fmt);
+        post(kind::info, lvl, fmt, args);
+        va_end(args);
     }
 
 
@@ -142,30 +375,10 @@ namespace notify {
             ...)
         noexcept
     {
-        std::va_list logger_args;
-        va_start(logger_args, fmt);
-        try {
-            std::string logger_fmt = "SUCCESS: "s + fmt + "\n"s;
-            logger::vprintf(logger_fmt.data(), logger_args);
-        }
-        catch (...) {}
-        va_end(logger_args);
-
-        if (lvl > max_level)
-            return;
-
-        std::va_list notify_args;
-        va_start(notify_args, fmt);
-        try {
-            wups::notify::info::vshow(wups::color{255, 255, 255},
-                                      wups::color{32, 160, 32},
-                                      fmt,
-                                      notify_args);
-        }
-        catch (std::exception& e) {
-            logger::printf("notification error: %s\n", e.what());
-        }
-        va_end(notify_args);
+        std::va_list args;
+        va_start(args, fmt);
+        post(kind::success, lvl, fmt, args);
+        va_end(args);
     }
 
 } // namespace notify
@@ -31,6 +31,19 @@ namespace notify {
         noexcept;
 
 
+    /*
+     * Messages are queued, and written out by a low-priority worker thread; without the
+     * worker, they're written out immediately.
+     */
+    void
+    start_worker();
+
+    // Stops the worker, after writing out all queued messages.
+    void
+    stop_worker()
+        noexcept;
+
+
     void
     set_max_level(level lvl)
         noexcept;
@@ -40,6 +53,14 @@ namespace notify {
         noexcept;
 
 
+    // Only written to the log, never shown.
+    __attribute__(( __format__ (__printf__, 1, 2)))
+    void
+    log(const char* fmt,
+        ...)
+        noexcept;
+
+
     __attribute__(( __format__ (__printf__, 2, 3)))
     void
     error(level lvl,
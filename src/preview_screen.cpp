@@ -7,6 +7,7 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <cstdio>               // snprintf()
 #include <utility>              // move()
 
 #include <wupsxx/text_item.hpp>
@@ -15,7 +16,8 @@
 
 #include "cfg.hpp"
 #include "clock_item.hpp"
-#include "utils.hpp"
+#include "time_service.hpp"
+#include "time_utils.hpp"
 
 
 using wups::category;
@@ -36,8 +38,19 @@ make_preview_screen()
 
     cat.add(std::move(clock));
 
-    auto servers = utils::split(cfg::server.value, " \t,;");
-    for (const auto& server : servers) {
+    if (auto state = time_service::read()) {
+        using time_utils::dbl_seconds;
+        using time_utils::seconds_to_human;
+        char buf[80];
+        std::snprintf(buf, sizeof buf, "%s (± %s), drift %.2f ppm",
+                      seconds_to_human(dbl_seconds{state->offset_ns * 1e-9}, true).data(),
+                      seconds_to_human(dbl_seconds{state->error_bound_ns * 1e-9}).data(),
+                      state->drift_ppm);
+        cat.add(text_item::create("Last sync:", buf, 80));
+    }
+
+    const auto servers = cfg::get_servers();
+    for (const auto& server : servers->names) {
         if (!server_infos.contains(server)) {
             auto& si = server_infos[server];
 
@@ -0,0 +1,125 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifdef __WIIU__
+#include <coreinit/core.h>
+#include <coreinit/thread.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "realtime.hpp"
+
+
+namespace realtime {
+
+#ifdef __WIIU__
+
+    // Priority 0 is the highest, 16 is the default, 31 is the lowest.
+    constexpr std::int32_t boosted_priority = 0;
+    constexpr std::int32_t lowest_priority = 31;
+
+
+    guard::guard(int core)
+        noexcept
+    {
+        OSThread* self = OSGetCurrentThread();
+
+        if (core < 0)
+            core = static_cast<int>(OSGetCoreId());
+        old_affinity = OSGetThreadAffinity(self);
+        pinned = OSSetThreadAffinity(self, OS_THREAD_ATTRIB_AFFINITY_CPU0 << core);
+
+        old_priority = OSGetThreadPriority(self);
+        boosted = OSSetThreadPriority(self, boosted_priority);
+    }
+
+
+    guard::~guard()
+        noexcept
+    {
+        OSThread* self = OSGetCurrentThread();
+        if (boosted)
+            OSSetThreadPriority(self, old_priority);
+        if (pinned)
+            OSSetThreadAffinity(self, old_affinity);
+    }
+
+
+    void
+    lower_priority()
+        noexcept
+    {
+        OSSetThreadPriority(OSGetCurrentThread(), lowest_priority);
+    }
+
+#else
+
+    // Host implementation, for testing on Linux; only the first 32 CPUs can be pinned.
+
+    guard::guard(int core)
+        noexcept
+    {
+        pthread_t self = pthread_self();
+
+        if (core < 0)
+            core = sched_getcpu();
+        cpu_set_t cpus;
+        if (core >= 0 && core < 32
+            && !pthread_getaffinity_np(self, sizeof cpus, &cpus)) {
+            for (int i = 0; i < 32; ++i)
+                if (CPU_ISSET(i, &cpus))
+                    old_affinity |= std::uint32_t{1} << i;
+            CPU_ZERO(&cpus);
+            CPU_SET(core, &cpus);
+            pinned = !pthread_setaffinity_np(self, sizeof cpus, &cpus);
+        }
+
+        // SCHED_FIFO usually needs privileges, so this often fails.
+        sched_param param;
+        if (!pthread_getschedparam(self, &old_policy, &param)) {
+            old_priority = param.sched_priority;
+            param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+            boosted = !pthread_setschedparam(self, SCHED_FIFO, &param);
+        }
+    }
+
+
+    guard::~guard()
+        noexcept
+    {
+        pthread_t self = pthread_self();
+        if (boosted) {
+            sched_param param;
+            param.sched_priority = old_priority;
+            pthread_setschedparam(self, old_policy, &param);
+        }
+        if (pinned) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            for (int i = 0; i < 32; ++i)
+                if (old_affinity & (std::uint32_t{1} << i))
+                    CPU_SET(i, &cpus);
+            pthread_setaffinity_np(self, sizeof cpus, &cpus);
+        }
+    }
+
+
+    void
+    lower_priority()
+        noexcept
+    {
+        sched_param param;
+        param.sched_priority = 0;
+        pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    }
+
+#endif
+
+} // namespace realtime
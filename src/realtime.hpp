@@ -0,0 +1,54 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef REALTIME_HPP
+#define REALTIME_HPP
+
+#include <cstdint>
+
+
+namespace realtime {
+
+    /*
+     * RAII class to run the current thread at the highest priority, pinned to one core,
+     * so it's not preempted or migrated while taking timestamps. Everything is restored
+     * on destruction.
+     *
+     * Boosting is best-effort: if the OS refuses it, the thread just runs as before.
+     */
+    class guard {
+
+        int old_priority = 0;
+        int old_policy = 0;     // only used on the host
+        std::uint32_t old_affinity = 0;
+        bool boosted = false;
+        bool pinned = false;
+
+    public:
+
+        // A negative `core` means the core the thread is currently running on.
+        explicit
+        guard(int core = -1)
+            noexcept;
+
+        ~guard()
+            noexcept;
+
+        guard(const guard&) = delete;
+
+    };
+
+
+    // Permanently drops the current thread to the lowest priority, for background chores.
+    void
+    lower_priority()
+        noexcept;
+
+} // namespace realtime
+
+#endif
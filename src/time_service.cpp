@@ -0,0 +1,101 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>               // FILE, fopen(), fwrite(), remove(), rename()
+
+#include <wupsxx/logger.hpp>
+
+#include "time_service.hpp"
+
+
+namespace logger = wups::logger;
+
+
+namespace time_service {
+
+    namespace {
+
+        /*
+         * Sequence lock: the writer makes `seq` odd while it updates the payload, so
+         * readers can detect a torn read and retry. Only `seq` is atomic, 32-bit atomics
+         * are lock-free on the Wii U; the fences order the plain payload accesses.
+         */
+        std::atomic<std::uint32_t> seq{0};
+        TimeSyncState payload{};
+
+
+        // Writes to a temporary file first, so readers never see a partial state.
+        void
+        export_state(const TimeSyncState& state)
+            noexcept
+        {
+            const char* tmp_path = TIME_SYNC_STATE_PATH ".tmp";
+            const TimeSyncStateFile contents{
+                .magic = TIME_SYNC_STATE_MAGIC,
+                .version = TIME_SYNC_API_VERSION,
+                .state = state,
+            };
+
+            std::FILE* f = std::fopen(tmp_path, "wb");
+            if (!f) {
+                logger::printf("ERROR: could not create \"%s\".\n", tmp_path);
+                return;
+            }
+            bool ok = std::fwrite(&contents, sizeof contents, 1, f) == 1;
+            ok = !std::fclose(f) && ok;
+            if (ok) {
+                // rename() doesn't replace existing files on FAT; see "time_sync.h".
+                std::remove(TIME_SYNC_STATE_PATH);
+                ok = !std::rename(tmp_path, TIME_SYNC_STATE_PATH);
+            }
+            if (!ok)
+                logger::printf("ERROR: could not write \"%s\".\n", TIME_SYNC_STATE_PATH);
+        }
+
+    } // namespace
+
+
+    void
+    publish(const TimeSyncState& state)
+        noexcept
+    {
+        auto s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        payload = state;
+
+        seq.store(s + 2, std::memory_order_release);
+
+        export_state(state);
+    }
+
+
+    std::optional<TimeSyncState>
+    read()
+        noexcept
+    {
+        TimeSyncState result;
+        std::uint32_t before;
+        std::uint32_t after;
+        do {
+            before = seq.load(std::memory_order_acquire);
+            if (before & 1)
+                continue;
+            result = payload;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = seq.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        if (!before)
+            return {};
+        return result;
+    }
+
+} // namespace time_service
@@ -0,0 +1,32 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef TIME_SERVICE_HPP
+#define TIME_SERVICE_HPP
+
+#include <optional>
+
+#include "time_sync.h"
+
+
+// Keeps the clock state described in "time_sync.h".
+namespace time_service {
+
+    // Only one thread may publish at a time. Also writes TIME_SYNC_STATE_PATH.
+    void
+    publish(const TimeSyncState& state)
+        noexcept;
+
+    // Never blocks; empty if nothing was published yet.
+    std::optional<TimeSyncState>
+    read()
+        noexcept;
+
+} // namespace time_service
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Clock state measured by Time Sync, for other homebrew.
+ *
+ * Aroma plugins can't export functions, so after every sync the state is written to
+ * TIME_SYNC_STATE_PATH as a TimeSyncStateFile (native byte order). A complete file is
+ * written under a temporary name first, so readers never see a partial state; but FAT
+ * can't rename over an existing file, so the old one is removed first, and for a moment
+ * the path doesn't exist. Readers should retry after a short delay if opening it fails.
+ * This header has everything needed to use it; nothing is linked from the plugin.
+ */
+
+#ifndef TIME_SYNC_H
+#define TIME_SYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <coreinit/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TIME_SYNC_API_VERSION 2
+
+#define TIME_SYNC_STATE_PATH "fs:/vol/external01/wiiu/time_sync_state.bin"
+
+#define TIME_SYNC_STATE_MAGIC 0x54535331 /* "TSS1" */
+
+typedef struct TimeSyncState {
+    /* Clock error measured by the last sync, in nanoseconds; positive means the clock was
+     * behind. */
+    int64_t offset_ns;
+    /* Part of the offset that was not corrected, because it was within the tolerance. */
+    int64_t residual_ns;
+    /* Bound on the error of the measurement, in nanoseconds. */
+    int64_t error_bound_ns;
+    /* Estimated clock drift, in parts per million; 0 until two syncs happened. */
+    double drift_ppm;
+    /* OSGetTime() when the last sync finished. */
+    int64_t last_sync_ticks;
+    /* Stratum of the time source; 0 if unknown (e.g. HTTP time). */
+    uint8_t stratum;
+} TimeSyncState;
+
+
+typedef struct TimeSyncStateFile {
+    uint32_t magic;             /* TIME_SYNC_STATE_MAGIC */
+    uint32_t version;           /* TIME_SYNC_API_VERSION */
+    TimeSyncState state;
+} TimeSyncStateFile;
+
+
+/*
+ * Current time, as OSGetTime() ticks, corrected for the drift since the last sync;
+ * `error_ns` (optional) receives the estimated error bound.
+ */
+static inline
+void
+TimeSync_EstimateTime(const TimeSyncState* state,
+                      int64_t* ticks,
+                      int64_t* error_ns)
+{
+    const OSTime now = OSGetTime();
+    const double elapsed = (double)(now - state->last_sync_ticks);
+    /* The clock keeps drifting at the same rate since the last sync. */
+    const double drift = elapsed * state->drift_ppm * 1e-6;
+    const double residual = state->residual_ns * 1e-9 * OSTimerClockSpeed;
+    if (ticks)
+        *ticks = now + (int64_t)(residual + drift);
+    if (error_ns) {
+        const double elapsed_ns = elapsed / OSTimerClockSpeed * 1e9;
+        const double drift_ppm = state->drift_ppm < 0 ? -state->drift_ppm : state->drift_ppm;
+        /* Assume the drift estimate is only good to 10%. */
+        *error_ns = state->error_bound_ns + (int64_t)(elapsed_ns * drift_ppm * 1e-7);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -6,6 +6,7 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <chrono>
 #include <cstdio>               // snprintf()
 #include <exception>
 #include <string.h>             // BSD strlcpy()
@@ -16,6 +17,7 @@
 #include "time_zone_query_item.hpp"
 
 #include "cfg.hpp"
+#include "utc.hpp"
 #include "utils.hpp"
 
 
@@ -112,9 +114,11 @@ void
 time_zone_query_item::run()
 {
     try {
+        utils::network_guard net_guard;
         auto [name, offset] = utils::fetch_timezone(variable);
         text = name;
-        cfg::set_and_store_utc_offset(offset);
+        auto now = std::chrono::floor<std::chrono::minutes>(utc::now(offset).value);
+        cfg::set_time_zone(name, offset, now);
     }
     catch (std::exception& e) {
         text = "Error: "s + e.what();
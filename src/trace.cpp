@@ -0,0 +1,183 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <algorithm>            // max()
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>               // FILE, fopen(), fprintf()
+#include <functional>           // hash<>
+#include <memory>               // unique_ptr<>
+#include <mutex>
+#include <stdexcept>            // runtime_error
+#include <system_error>         // errc, make_error_code()
+#include <thread>
+
+#include "trace.hpp"
+
+
+namespace trace {
+
+    namespace {
+
+        struct event {
+            const char*   name = nullptr;
+            OSTime        start = 0;
+            OSTime        duration = 0;
+            std::uint32_t thread = 0;
+        };
+
+        // Enough for a few syncs with a handful of servers each.
+        std::array<event, 256> events;
+        std::size_t next_event = 0;
+        bool wrapped = false;
+        std::mutex events_mutex;
+
+
+        constexpr std::array counter_names{
+            "queries",
+            "timeouts",
+            "enomem_retries",
+            "bytes_sent",
+            "bytes_received",
+        };
+
+        // 64-bit atomics are not lock-free on the Wii U.
+        std::array<std::atomic<std::uint32_t>, counter_names.size()> counters{};
+
+
+        std::uint32_t
+        thread_id()
+            noexcept
+        {
+            return std::hash<std::thread::id>{}(std::this_thread::get_id());
+        }
+
+
+        void
+        record(const char* name,
+               OSTime start,
+               OSTime finish)
+            noexcept
+        {
+            const auto tid = thread_id();
+            std::lock_guard lock{events_mutex};
+            events[next_event] = {name, start, finish - start, tid};
+            if (++next_event == events.size()) {
+                next_event = 0;
+                wrapped = true;
+            }
+        }
+
+
+        long long
+        to_us(OSTime ticks)
+            noexcept
+        {
+            return OSTicksToMicroseconds(ticks);
+        }
+
+    } // namespace
+
+
+    // NOTE: OSGetSystemTime() is not affected by clock changes.
+
+    span::span(const char* name)
+        noexcept :
+        name{name},
+        start{OSGetSystemTime()}
+    {}
+
+
+    span::~span()
+        noexcept
+    {
+        finish();
+    }
+
+
+    void
+    span::stop()
+        noexcept
+    {
+        if (!end)
+            end = OSGetSystemTime();
+    }
+
+
+    void
+    span::finish()
+        noexcept
+    {
+        if (finished)
+            return;
+        finished = true;
+        stop();
+        record(name, start, end);
+    }
+
+
+    void
+    add(counter c,
+        std::uint32_t n)
+        noexcept
+    {
+        counters[static_cast<unsigned>(c)].fetch_add(n, std::memory_order_relaxed);
+    }
+
+
+    void
+    export_json(const std::string& path)
+    {
+        // Copy the events out, so the lock isn't held during file I/O.
+        std::array<event, events.size()> snapshot;
+        std::size_t first, count;
+        {
+            std::lock_guard lock{events_mutex};
+            snapshot = events;
+            first = wrapped ? next_event : 0;
+            count = wrapped ? events.size() : next_event;
+        }
+
+        std::unique_ptr<std::FILE, int(*)(std::FILE*)> file{std::fopen(path.data(), "w"),
+                                                             std::fclose};
+        if (!file)
+            throw std::runtime_error{"Could not open \"" + path + "\": "
+                                     + std::make_error_code(std::errc{errno}).message()};
+        std::FILE* f = file.get();
+
+        std::fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        OSTime last = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            const event& e = snapshot[(first + i) % snapshot.size()];
+            std::fprintf(f,
+                         "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,"
+                         "\"ts\":%lld,\"dur\":%lld},\n",
+                         e.name,
+                         static_cast<unsigned long>(e.thread),
+                         to_us(e.start),
+                         to_us(e.duration));
+            last = std::max(last, e.start + e.duration);
+        }
+
+        // The counters go in a single counter event, at the end.
+        std::fprintf(f, "{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,\"ts\":%lld,\"args\":{",
+                     to_us(last));
+        for (std::size_t i = 0; i < counter_names.size(); ++i)
+            std::fprintf(f,
+                         "%s\"%s\":%lu",
+                         i ? "," : "",
+                         counter_names[i],
+                         static_cast<unsigned long>(counters[i].load()));
+        std::fprintf(f, "}}\n]}\n");
+
+        if (std::ferror(f))
+            throw std::runtime_error{"Error writing to \"" + path + "\"."};
+    }
+
+} // namespace trace
@@ -0,0 +1,81 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cstdint>
+#include <string>
+
+#include <coreinit/time.h>
+
+
+/*
+ * Lightweight timing of the sync pipeline. Spans are kept in a fixed-size ring buffer,
+ * so only the most recent ones are available, and can be exported in the Chrome
+ * trace_event format (open it in chrome://tracing or ui.perfetto.dev).
+ */
+namespace trace {
+
+    // RAII class to record how long a scope took. The name must be a string literal.
+    class span {
+
+        const char* name;
+        OSTime start;
+        OSTime end = 0;
+        bool finished = false;
+
+    public:
+
+        explicit
+        span(const char* name)
+            noexcept;
+
+        ~span()
+            noexcept;
+
+        span(const span&) = delete;
+
+        // Marks the end of the span, but only records it later; this is just a tick read.
+        void
+        stop()
+            noexcept;
+
+        // Records the span now, instead of at destruction.
+        void
+        finish()
+            noexcept;
+
+    };
+
+
+    enum class counter : unsigned {
+        queries,
+        timeouts,
+        enomem_retries,
+        bytes_sent,
+        bytes_received,
+    };
+
+    void
+    add(counter c,
+        std::uint32_t n = 1)
+        noexcept;
+
+
+    // Where export_json() writes to, by default.
+    inline constexpr const char* default_path =
+        "fs:/vol/external01/wiiu/time_sync_trace.json";
+
+    // Throws std::runtime_error on I/O errors.
+    void
+    export_json(const std::string& path = default_path);
+
+} // namespace trace
+
+#endif
@@ -0,0 +1,715 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <algorithm>            // ranges::is_sorted(), ranges::lower_bound()
+#include <array>
+#include <stdexcept>            // invalid_argument
+
+#include "tz.hpp"
+
+
+using namespace std::literals;
+
+using std::chrono::minutes;
+
+
+namespace tz {
+
+    namespace {
+
+        /*
+         * Parser for POSIX TZ strings, only used at compile time: a malformed entry in
+         * the table below is a compilation error.
+         */
+        struct posix_parser {
+
+            std::string_view input;
+
+
+            consteval
+            bool
+            eof()
+                const
+            {
+                return input.empty();
+            }
+
+
+            consteval
+            bool
+            accept(char c)
+            {
+                if (eof() || input.front() != c)
+                    return false;
+                input.remove_prefix(1);
+                return true;
+            }
+
+
+            consteval
+            void
+            expect(char c)
+            {
+                if (!accept(c))
+                    throw std::invalid_argument{"unexpected character in TZ string"};
+            }
+
+
+            consteval
+            int
+            number()
+            {
+                if (eof() || input.front() < '0' || input.front() > '9')
+                    throw std::invalid_argument{"expected a number in TZ string"};
+                int result = 0;
+                while (!eof() && input.front() >= '0' && input.front() <= '9') {
+                    result = result * 10 + (input.front() - '0');
+                    input.remove_prefix(1);
+                }
+                return result;
+            }
+
+
+            // Skips "ABC" or "<+0530>".
+            consteval
+            void
+            abbreviation()
+            {
+                if (accept('<')) {
+                    while (!accept('>'))
+                        input.remove_prefix(1);
+                    return;
+                }
+                if (eof() || input.front() < 'A' || input.front() > 'z')
+                    throw std::invalid_argument{"expected an abbreviation in TZ string"};
+                while (!eof() && ((input.front() >= 'A' && input.front() <= 'Z')
+                                  || (input.front() >= 'a' && input.front() <= 'z')))
+                    input.remove_prefix(1);
+            }
+
+
+            // Parses "[+-]hh[:mm]" into minutes.
+            consteval
+            int
+            time()
+            {
+                int sign = 1;
+                if (accept('-'))
+                    sign = -1;
+                else
+                    accept('+');
+                int result = number() * 60;
+                if (accept(':'))
+                    result += number();
+                return sign * result;
+            }
+
+
+            // Parses "Mm.w.d[/time]".
+            consteval
+            rule
+            transition()
+            {
+                expect('M');
+                rule result;
+                result.month = number();
+                expect('.');
+                result.week = number();
+                expect('.');
+                result.weekday = number();
+                result.time = accept('/') ? time() : 2 * 60;
+                if (result.month < 1 || result.month > 12
+                    || result.week < 1 || result.week > 5
+                    || result.weekday > 6)
+                    throw std::invalid_argument{"invalid transition in TZ string"};
+                return result;
+            }
+
+
+            consteval
+            zone
+            parse()
+            {
+                zone result;
+                abbreviation();
+                // POSIX offsets are positive west of Greenwich.
+                result.std_offset = -time();
+                result.dst_offset = result.std_offset;
+                if (!eof()) {
+                    abbreviation();
+                    if (!eof() && input.front() != ',')
+                        result.dst_offset = -time();
+                    else
+                        result.dst_offset = result.std_offset + 60;
+                    expect(',');
+                    result.dst_start = transition();
+                    expect(',');
+                    result.dst_end = transition();
+                }
+                if (!eof())
+                    throw std::invalid_argument{"trailing characters in TZ string"};
+                return result;
+            }
+
+        };
+
+
+        struct entry {
+            std::string_view name;
+            zone             rules;
+        };
+
+
+        consteval
+        entry
+        make_entry(std::string_view name,
+                   std::string_view posix)
+        {
+            return { name, posix_parser{posix}.parse() };
+        }
+
+
+        // Generated from the POSIX TZ strings in the IANA database (2025a), sorted by name.
+        constexpr std::array table = {
+        make_entry("Africa/Abidjan",                "GMT0"),
+        make_entry("Africa/Accra",                  "GMT0"),
+        make_entry("Africa/Addis_Ababa",            "EAT-3"),
+        make_entry("Africa/Algiers",                "CET-1"),
+        make_entry("Africa/Bamako",                 "GMT0"),
+        make_entry("Africa/Cairo",                  "EET-2EEST,M4.5.5/0,M10.5.4/24"),
+        make_entry("Africa/Casablanca",             "<+01>-1"),
+        make_entry("Africa/Ceuta",                  "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Africa/Dakar",                  "GMT0"),
+        make_entry("Africa/Dar_es_Salaam",          "EAT-3"),
+        make_entry("Africa/Douala",                 "WAT-1"),
+        make_entry("Africa/El_Aaiun",               "<+01>-1"),
+        make_entry("Africa/Gaborone",               "CAT-2"),
+        make_entry("Africa/Harare",                 "CAT-2"),
+        make_entry("Africa/Johannesburg",           "SAST-2"),
+        make_entry("Africa/Juba",                   "CAT-2"),
+        make_entry("Africa/Kampala",                "EAT-3"),
+        make_entry("Africa/Khartoum",               "CAT-2"),
+        make_entry("Africa/Kigali",                 "CAT-2"),
+        make_entry("Africa/Kinshasa",               "WAT-1"),
+        make_entry("Africa/Lagos",                  "WAT-1"),
+        make_entry("Africa/Libreville",             "WAT-1"),
+        make_entry("Africa/Luanda",                 "WAT-1"),
+        make_entry("Africa/Lusaka",                 "CAT-2"),
+        make_entry("Africa/Maputo",                 "CAT-2"),
+        make_entry("Africa/Mogadishu",              "EAT-3"),
+        make_entry("Africa/Monrovia",               "GMT0"),
+        make_entry("Africa/Nairobi",                "EAT-3"),
+        make_entry("Africa/Tripoli",                "EET-2"),
+        make_entry("Africa/Tunis",                  "CET-1"),
+        make_entry("Africa/Windhoek",               "CAT-2"),
+        make_entry("America/Adak",                  "HST10HDT,M3.2.0,M11.1.0"),
+        make_entry("America/Anchorage",             "AKST9AKDT,M3.2.0,M11.1.0"),
+        make_entry("America/Argentina/Buenos_Aires","<-03>3"),
+        make_entry("America/Asuncion",              "<-03>3"),
+        make_entry("America/Bahia",                 "<-03>3"),
+        make_entry("America/Barbados",              "AST4"),
+        make_entry("America/Belem",                 "<-03>3"),
+        make_entry("America/Belize",                "CST6"),
+        make_entry("America/Bogota",                "<-05>5"),
+        make_entry("America/Boise",                 "MST7MDT,M3.2.0,M11.1.0"),
+        make_entry("America/Buenos_Aires",          "<-03>3"),
+        make_entry("America/Cancun",                "EST5"),
+        make_entry("America/Caracas",               "<-04>4"),
+        make_entry("America/Cayenne",               "<-03>3"),
+        make_entry("America/Chicago",               "CST6CDT,M3.2.0,M11.1.0"),
+        make_entry("America/Chihuahua",             "CST6"),
+        make_entry("America/Ciudad_Juarez",         "MST7MDT,M3.2.0,M11.1.0"),
+        make_entry("America/Costa_Rica",            "CST6"),
+        make_entry("America/Denver",                "MST7MDT,M3.2.0,M11.1.0"),
+        make_entry("America/Detroit",               "EST5EDT,M3.2.0,M11.1.0"),
+        make_entry("America/Edmonton",              "MST7MDT,M3.2.0,M11.1.0"),
+        make_entry("America/El_Salvador",           "CST6"),
+        make_entry("America/Fortaleza",             "<-03>3"),
+        make_entry("America/Godthab",               "<-02>2<-01>,M3.5.0/-1,M10.5.0/0"),
+        make_entry("America/Guatemala",             "CST6"),
+        make_entry("America/Guayaquil",             "<-05>5"),
+        make_entry("America/Guyana",                "<-04>4"),
+        make_entry("America/Halifax",               "AST4ADT,M3.2.0,M11.1.0"),
+        make_entry("America/Havana",                "CST5CDT,M3.2.0/0,M11.1.0/1"),
+        make_entry("America/Hermosillo",            "MST7"),
+        make_entry("America/Indiana/Indianapolis",  "EST5EDT,M3.2.0,M11.1.0"),
+        make_entry("America/Indiana/Knox",          "CST6CDT,M3.2.0,M11.1.0"),
+        make_entry("America/Iqaluit",               "EST5EDT,M3.2.0,M11.1.0"),
+        make_entry("America/Jamaica",               "EST5"),
+        make_entry("America/Juneau",                "AKST9AKDT,M3.2.0,M11.1.0"),
+        make_entry("America/Kentucky/Louisville",   "EST5EDT,M3.2.0,M11.1.0"),
+        make_entry("America/La_Paz",                "<-04>4"),
+        make_entry("America/Lima",                  "<-05>5"),
+        make_entry("America/Los_Angeles",           "PST8PDT,M3.2.0,M11.1.0"),
+        make_entry("America/Managua",               "CST6"),
+        make_entry("America/Manaus",                "<-04>4"),
+        make_entry("America/Martinique",            "AST4"),
+        make_entry("America/Matamoros",             "CST6CDT,M3.2.0,M11.1.0"),
+        make_entry("America/Mazatlan",              "MST7"),
+        make_entry("America/Menominee",             "CST6CDT,M3.2.0,M11.1.0"),
+        make_entry("America/Merida",                "CST6"),
+        make_entry("America/Mexico_City",           "CST6"),
+        make_entry("America/Miquelon",              "<-03>3<-02>,M3.2.0,M11.1.0"),
+        make_entry("America/Moncton",               "AST4ADT,M3.2.0,M11.1.0"),
+        make_entry("America/Monterrey",             "CST6"),
+        make_entry("America/Montevideo",            "<-03>3"),
+        make_entry("America/Nassau",                "EST5EDT,M3.2.0,M11.1.0"),
+        make_entry("America/New_York",              "EST5EDT,M3.2.0,M11.1.0"),
+        make_entry("America/Noronha",               "<-02>2"),
+        make_entry("America/Nuuk",                  "<-02>2<-01>,M3.5.0/-1,M10.5.0/0"),
+        make_entry("America/Panama",                "EST5"),
+        make_entry("America/Paramaribo",            "<-03>3"),
+        make_entry("America/Phoenix",               "MST7"),
+        make_entry("America/Port-au-Prince",        "EST5EDT,M3.2.0,M11.1.0"),
+        make_entry("America/Port_of_Spain",         "AST4"),
+        make_entry("America/Puerto_Rico",           "AST4"),
+        make_entry("America/Punta_Arenas",          "<-03>3"),
+        make_entry("America/Recife",                "<-03>3"),
+        make_entry("America/Regina",                "CST6"),
+        make_entry("America/Rio_Branco",            "<-05>5"),
+        make_entry("America/Santiago",              "<-04>4<-03>,M9.1.6/24,M4.1.6/24"),
+        make_entry("America/Santo_Domingo",         "AST4"),
+        make_entry("America/Sao_Paulo",             "<-03>3"),
+        make_entry("America/St_Johns",              "NST3:30NDT,M3.2.0,M11.1.0"),
+        make_entry("America/Tegucigalpa",           "CST6"),
+        make_entry("America/Thule",                 "AST4ADT,M3.2.0,M11.1.0"),
+        make_entry("America/Tijuana",               "PST8PDT,M3.2.0,M11.1.0"),
+        make_entry("America/Toronto",               "EST5EDT,M3.2.0,M11.1.0"),
+        make_entry("America/Vancouver",             "PST8PDT,M3.2.0,M11.1.0"),
+        make_entry("America/Winnipeg",              "CST6CDT,M3.2.0,M11.1.0"),
+        make_entry("Arctic/Longyearbyen",           "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Asia/Aden",                     "<+03>-3"),
+        make_entry("Asia/Almaty",                   "<+05>-5"),
+        make_entry("Asia/Amman",                    "<+03>-3"),
+        make_entry("Asia/Aqtobe",                   "<+05>-5"),
+        make_entry("Asia/Ashgabat",                 "<+05>-5"),
+        make_entry("Asia/Baghdad",                  "<+03>-3"),
+        make_entry("Asia/Bahrain",                  "<+03>-3"),
+        make_entry("Asia/Baku",                     "<+04>-4"),
+        make_entry("Asia/Bangkok",                  "<+07>-7"),
+        make_entry("Asia/Beirut",                   "EET-2EEST,M3.5.0/0,M10.5.0/0"),
+        make_entry("Asia/Bishkek",                  "<+06>-6"),
+        make_entry("Asia/Brunei",                   "<+08>-8"),
+        make_entry("Asia/Calcutta",                 "IST-5:30"),
+        make_entry("Asia/Colombo",                  "<+0530>-5:30"),
+        make_entry("Asia/Damascus",                 "<+03>-3"),
+        make_entry("Asia/Dhaka",                    "<+06>-6"),
+        make_entry("Asia/Dubai",                    "<+04>-4"),
+        make_entry("Asia/Dushanbe",                 "<+05>-5"),
+        make_entry("Asia/Famagusta",                "EET-2EEST,M3.5.0/3,M10.5.0/4"),
+        make_entry("Asia/Ho_Chi_Minh",              "<+07>-7"),
+        make_entry("Asia/Hong_Kong",                "HKT-8"),
+        make_entry("Asia/Irkutsk",                  "<+08>-8"),
+        make_entry("Asia/Jakarta",                  "WIB-7"),
+        make_entry("Asia/Jayapura",                 "WIT-9"),
+        make_entry("Asia/Jerusalem",                "IST-2IDT,M3.4.4/26,M10.5.0"),
+        make_entry("Asia/Kabul",                    "<+0430>-4:30"),
+        make_entry("Asia/Kamchatka",                "<+12>-12"),
+        make_entry("Asia/Karachi",                  "PKT-5"),
+        make_entry("Asia/Kathmandu",                "<+0545>-5:45"),
+        make_entry("Asia/Kolkata",                  "IST-5:30"),
+        make_entry("Asia/Krasnoyarsk",              "<+07>-7"),
+        make_entry("Asia/Kuala_Lumpur",             "<+08>-8"),
+        make_entry("Asia/Kuwait",                   "<+03>-3"),
+        make_entry("Asia/Macau",                    "CST-8"),
+        make_entry("Asia/Magadan",                  "<+11>-11"),
+        make_entry("Asia/Makassar",                 "WITA-8"),
+        make_entry("Asia/Manila",                   "PST-8"),
+        make_entry("Asia/Muscat",                   "<+04>-4"),
+        make_entry("Asia/Nicosia",                  "EET-2EEST,M3.5.0/3,M10.5.0/4"),
+        make_entry("Asia/Novosibirsk",              "<+07>-7"),
+        make_entry("Asia/Omsk",                     "<+06>-6"),
+        make_entry("Asia/Phnom_Penh",               "<+07>-7"),
+        make_entry("Asia/Pontianak",                "WIB-7"),
+        make_entry("Asia/Pyongyang",                "KST-9"),
+        make_entry("Asia/Qatar",                    "<+03>-3"),
+        make_entry("Asia/Riyadh",                   "<+03>-3"),
+        make_entry("Asia/Saigon",                   "<+07>-7"),
+        make_entry("Asia/Samarkand",                "<+05>-5"),
+        make_entry("Asia/Seoul",                    "KST-9"),
+        make_entry("Asia/Shanghai",                 "CST-8"),
+        make_entry("Asia/Singapore",                "<+08>-8"),
+        make_entry("Asia/Taipei",                   "CST-8"),
+        make_entry("Asia/Tashkent",                 "<+05>-5"),
+        make_entry("Asia/Tbilisi",                  "<+04>-4"),
+        make_entry("Asia/Tehran",                   "<+0330>-3:30"),
+        make_entry("Asia/Tel_Aviv",                 "IST-2IDT,M3.4.4/26,M10.5.0"),
+        make_entry("Asia/Thimphu",                  "<+06>-6"),
+        make_entry("Asia/Tokyo",                    "JST-9"),
+        make_entry("Asia/Ulaanbaatar",              "<+08>-8"),
+        make_entry("Asia/Vientiane",                "<+07>-7"),
+        make_entry("Asia/Vladivostok",              "<+10>-10"),
+        make_entry("Asia/Yakutsk",                  "<+09>-9"),
+        make_entry("Asia/Yangon",                   "<+0630>-6:30"),
+        make_entry("Asia/Yekaterinburg",            "<+05>-5"),
+        make_entry("Asia/Yerevan",                  "<+04>-4"),
+        make_entry("Atlantic/Azores",               "<-01>1<+00>,M3.5.0/0,M10.5.0/1"),
+        make_entry("Atlantic/Bermuda",              "AST4ADT,M3.2.0,M11.1.0"),
+        make_entry("Atlantic/Canary",               "WET0WEST,M3.5.0/1,M10.5.0"),
+        make_entry("Atlantic/Faroe",                "WET0WEST,M3.5.0/1,M10.5.0"),
+        make_entry("Atlantic/Madeira",              "WET0WEST,M3.5.0/1,M10.5.0"),
+        make_entry("Atlantic/Reykjavik",            "GMT0"),
+        make_entry("Australia/Adelaide",            "ACST-9:30ACDT,M10.1.0,M4.1.0/3"),
+        make_entry("Australia/Brisbane",            "AEST-10"),
+        make_entry("Australia/Broken_Hill",         "ACST-9:30ACDT,M10.1.0,M4.1.0/3"),
+        make_entry("Australia/Canberra",            "AEST-10AEDT,M10.1.0,M4.1.0/3"),
+        make_entry("Australia/Darwin",              "ACST-9:30"),
+        make_entry("Australia/Hobart",              "AEST-10AEDT,M10.1.0,M4.1.0/3"),
+        make_entry("Australia/Lindeman",            "AEST-10"),
+        make_entry("Australia/Lord_Howe",           "<+1030>-10:30<+11>-11,M10.1.0,M4.1.0"),
+        make_entry("Australia/Melbourne",           "AEST-10AEDT,M10.1.0,M4.1.0/3"),
+        make_entry("Australia/Perth",               "AWST-8"),
+        make_entry("Australia/Sydney",              "AEST-10AEDT,M10.1.0,M4.1.0/3"),
+        make_entry("Etc/GMT",                       "GMT0"),
+        make_entry("Etc/UTC",                       "UTC0"),
+        make_entry("Europe/Amsterdam",              "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Andorra",                "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Athens",                 "EET-2EEST,M3.5.0/3,M10.5.0/4"),
+        make_entry("Europe/Belgrade",               "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Berlin",                 "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Bratislava",             "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Brussels",               "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Bucharest",              "EET-2EEST,M3.5.0/3,M10.5.0/4"),
+        make_entry("Europe/Budapest",               "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Busingen",               "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Chisinau",               "EET-2EEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Copenhagen",             "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Dublin",                 "GMT0IST,M3.5.0/1,M10.5.0"),
+        make_entry("Europe/Gibraltar",              "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Guernsey",               "GMT0BST,M3.5.0/1,M10.5.0"),
+        make_entry("Europe/Helsinki",               "EET-2EEST,M3.5.0/3,M10.5.0/4"),
+        make_entry("Europe/Isle_of_Man",            "GMT0BST,M3.5.0/1,M10.5.0"),
+        make_entry("Europe/Istanbul",               "<+03>-3"),
+        make_entry("Europe/Jersey",                 "GMT0BST,M3.5.0/1,M10.5.0"),
+        make_entry("Europe/Kaliningrad",            "EET-2"),
+        make_entry("Europe/Kiev",                   "EET-2EEST,M3.5.0/3,M10.5.0/4"),
+        make_entry("Europe/Kyiv",                   "EET-2EEST,M3.5.0/3,M10.5.0/4"),
+        make_entry("Europe/Lisbon",                 "WET0WEST,M3.5.0/1,M10.5.0"),
+        make_entry("Europe/Ljubljana",              "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/London",                 "GMT0BST,M3.5.0/1,M10.5.0"),
+        make_entry("Europe/Luxembourg",             "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Madrid",                 "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Malta",                  "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Mariehamn",              "EET-2EEST,M3.5.0/3,M10.5.0/4"),
+        make_entry("Europe/Minsk",                  "<+03>-3"),
+        make_entry("Europe/Monaco",                 "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Moscow",                 "MSK-3"),
+        make_entry("Europe/Nicosia",                "EET-2EEST,M3.5.0/3,M10.5.0/4"),
+        make_entry("Europe/Oslo",                   "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Paris",                  "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Podgorica",              "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Prague",                 "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Riga",                   "EET-2EEST,M3.5.0/3,M10.5.0/4"),
+        make_entry("Europe/Rome",                   "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Samara",                 "<+04>-4"),
+        make_entry("Europe/San_Marino",             "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Sarajevo",               "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Skopje",                 "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Sofia",                  "EET-2EEST,M3.5.0/3,M10.5.0/4"),
+        make_entry("Europe/Stockholm",              "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Tallinn",                "EET-2EEST,M3.5.0/3,M10.5.0/4"),
+        make_entry("Europe/Tirane",                 "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Vaduz",                  "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Vatican",                "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Vienna",                 "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Vilnius",                "EET-2EEST,M3.5.0/3,M10.5.0/4"),
+        make_entry("Europe/Volgograd",              "MSK-3"),
+        make_entry("Europe/Warsaw",                 "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Zagreb",                 "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("Europe/Zurich",                 "CET-1CEST,M3.5.0,M10.5.0/3"),
+        make_entry("GMT",                           "GMT0"),
+        make_entry("Indian/Maldives",               "<+05>-5"),
+        make_entry("Indian/Mauritius",              "<+04>-4"),
+        make_entry("Indian/Reunion",                "<+04>-4"),
+        make_entry("Pacific/Apia",                  "<+13>-13"),
+        make_entry("Pacific/Auckland",              "NZST-12NZDT,M9.5.0,M4.1.0/3"),
+        make_entry("Pacific/Chatham",               "<+1245>-12:45<+1345>,M9.5.0/2:45,M4.1.0/3:45"),
+        make_entry("Pacific/Easter",                "<-06>6<-05>,M9.1.6/22,M4.1.6/22"),
+        make_entry("Pacific/Fiji",                  "<+12>-12"),
+        make_entry("Pacific/Guadalcanal",           "<+11>-11"),
+        make_entry("Pacific/Guam",                  "ChST-10"),
+        make_entry("Pacific/Honolulu",              "HST10"),
+        make_entry("Pacific/Kiritimati",            "<+14>-14"),
+        make_entry("Pacific/Norfolk",               "<+11>-11<+12>,M10.1.0,M4.1.0/3"),
+        make_entry("Pacific/Noumea",                "<+11>-11"),
+        make_entry("Pacific/Pago_Pago",             "SST11"),
+        make_entry("Pacific/Port_Moresby",          "<+10>-10"),
+        make_entry("Pacific/Saipan",                "ChST-10"),
+        make_entry("Pacific/Tahiti",                "<-10>10"),
+        make_entry("Pacific/Tongatapu",             "<+13>-13"),
+        make_entry("UTC",                           "UTC0"),
+        };
+
+        static_assert(std::ranges::is_sorted(table, {}, &entry::name));
+
+
+        struct pool_entry {
+            std::string_view name;
+            std::string_view pool;
+        };
+
+
+        /*
+         * NTP pool zones for time zones that don't map to their continent's pool zone.
+         * Only countries with a large number of pool servers get their own zone.
+         */
+        constexpr std::array pool_table = {
+        pool_entry{"Africa/Ceuta",                "es"},
+        pool_entry{"Africa/Johannesburg",         "za"},
+        pool_entry{"America/Adak",                "us"},
+        pool_entry{"America/Anchorage",           "us"},
+        pool_entry{"America/Argentina/Buenos_Aires","ar"},
+        pool_entry{"America/Asuncion",            "south-america"},
+        pool_entry{"America/Bahia",               "br"},
+        pool_entry{"America/Belem",               "br"},
+        pool_entry{"America/Bogota",              "south-america"},
+        pool_entry{"America/Boise",               "us"},
+        pool_entry{"America/Buenos_Aires",        "ar"},
+        pool_entry{"America/Cancun",              "mx"},
+        pool_entry{"America/Caracas",             "south-america"},
+        pool_entry{"America/Cayenne",             "south-america"},
+        pool_entry{"America/Chicago",             "us"},
+        pool_entry{"America/Chihuahua",           "mx"},
+        pool_entry{"America/Ciudad_Juarez",       "mx"},
+        pool_entry{"America/Denver",              "us"},
+        pool_entry{"America/Detroit",             "us"},
+        pool_entry{"America/Edmonton",            "ca"},
+        pool_entry{"America/Fortaleza",           "br"},
+        pool_entry{"America/Guayaquil",           "south-america"},
+        pool_entry{"America/Guyana",              "south-america"},
+        pool_entry{"America/Halifax",             "ca"},
+        pool_entry{"America/Hermosillo",          "mx"},
+        pool_entry{"America/Indiana/Indianapolis","us"},
+        pool_entry{"America/Indiana/Knox",        "us"},
+        pool_entry{"America/Iqaluit",             "ca"},
+        pool_entry{"America/Juneau",              "us"},
+        pool_entry{"America/Kentucky/Louisville", "us"},
+        pool_entry{"America/La_Paz",              "south-america"},
+        pool_entry{"America/Lima",                "south-america"},
+        pool_entry{"America/Los_Angeles",         "us"},
+        pool_entry{"America/Manaus",              "br"},
+        pool_entry{"America/Matamoros",           "mx"},
+        pool_entry{"America/Mazatlan",            "mx"},
+        pool_entry{"America/Menominee",           "us"},
+        pool_entry{"America/Merida",              "mx"},
+        pool_entry{"America/Mexico_City",         "mx"},
+        pool_entry{"America/Moncton",             "ca"},
+        pool_entry{"America/Monterrey",           "mx"},
+        pool_entry{"America/Montevideo",          "south-america"},
+        pool_entry{"America/New_York",            "us"},
+        pool_entry{"America/Noronha",             "br"},
+        pool_entry{"America/Paramaribo",          "south-america"},
+        pool_entry{"America/Phoenix",             "us"},
+        pool_entry{"America/Punta_Arenas",        "cl"},
+        pool_entry{"America/Recife",              "br"},
+        pool_entry{"America/Regina",              "ca"},
+        pool_entry{"America/Rio_Branco",          "br"},
+        pool_entry{"America/Santiago",            "cl"},
+        pool_entry{"America/Sao_Paulo",           "br"},
+        pool_entry{"America/St_Johns",            "ca"},
+        pool_entry{"America/Tijuana",             "mx"},
+        pool_entry{"America/Toronto",             "ca"},
+        pool_entry{"America/Vancouver",           "ca"},
+        pool_entry{"America/Winnipeg",            "ca"},
+        pool_entry{"Asia/Calcutta",               "in"},
+        pool_entry{"Asia/Hong_Kong",              "hk"},
+        pool_entry{"Asia/Irkutsk",                "ru"},
+        pool_entry{"Asia/Kamchatka",              "ru"},
+        pool_entry{"Asia/Kolkata",                "in"},
+        pool_entry{"Asia/Krasnoyarsk",            "ru"},
+        pool_entry{"Asia/Magadan",                "ru"},
+        pool_entry{"Asia/Novosibirsk",            "ru"},
+        pool_entry{"Asia/Omsk",                   "ru"},
+        pool_entry{"Asia/Seoul",                  "kr"},
+        pool_entry{"Asia/Shanghai",               "cn"},
+        pool_entry{"Asia/Singapore",              "sg"},
+        pool_entry{"Asia/Taipei",                 "tw"},
+        pool_entry{"Asia/Tokyo",                  "jp"},
+        pool_entry{"Asia/Vladivostok",            "ru"},
+        pool_entry{"Asia/Yakutsk",                "ru"},
+        pool_entry{"Asia/Yekaterinburg",          "ru"},
+        pool_entry{"Atlantic/Azores",             "pt"},
+        pool_entry{"Atlantic/Bermuda",            "north-america"},
+        pool_entry{"Atlantic/Canary",             "es"},
+        pool_entry{"Atlantic/Faroe",              "europe"},
+        pool_entry{"Atlantic/Madeira",            "pt"},
+        pool_entry{"Atlantic/Reykjavik",          "europe"},
+        pool_entry{"Australia/Adelaide",          "au"},
+        pool_entry{"Australia/Brisbane",          "au"},
+        pool_entry{"Australia/Broken_Hill",       "au"},
+        pool_entry{"Australia/Canberra",          "au"},
+        pool_entry{"Australia/Darwin",            "au"},
+        pool_entry{"Australia/Hobart",            "au"},
+        pool_entry{"Australia/Lindeman",          "au"},
+        pool_entry{"Australia/Lord_Howe",         "au"},
+        pool_entry{"Australia/Melbourne",         "au"},
+        pool_entry{"Australia/Perth",             "au"},
+        pool_entry{"Australia/Sydney",            "au"},
+        pool_entry{"Europe/Amsterdam",            "nl"},
+        pool_entry{"Europe/Athens",               "gr"},
+        pool_entry{"Europe/Berlin",               "de"},
+        pool_entry{"Europe/Brussels",             "be"},
+        pool_entry{"Europe/Bucharest",            "ro"},
+        pool_entry{"Europe/Budapest",             "hu"},
+        pool_entry{"Europe/Busingen",             "de"},
+        pool_entry{"Europe/Copenhagen",           "dk"},
+        pool_entry{"Europe/Dublin",               "ie"},
+        pool_entry{"Europe/Guernsey",             "uk"},
+        pool_entry{"Europe/Helsinki",             "fi"},
+        pool_entry{"Europe/Isle_of_Man",          "uk"},
+        pool_entry{"Europe/Istanbul",             "tr"},
+        pool_entry{"Europe/Jersey",               "uk"},
+        pool_entry{"Europe/Kaliningrad",          "ru"},
+        pool_entry{"Europe/Kiev",                 "ua"},
+        pool_entry{"Europe/Kyiv",                 "ua"},
+        pool_entry{"Europe/Lisbon",               "pt"},
+        pool_entry{"Europe/London",               "uk"},
+        pool_entry{"Europe/Madrid",               "es"},
+        pool_entry{"Europe/Moscow",               "ru"},
+        pool_entry{"Europe/Oslo",                 "no"},
+        pool_entry{"Europe/Paris",                "fr"},
+        pool_entry{"Europe/Prague",               "cz"},
+        pool_entry{"Europe/Rome",                 "it"},
+        pool_entry{"Europe/Samara",               "ru"},
+        pool_entry{"Europe/Sofia",                "bg"},
+        pool_entry{"Europe/Stockholm",            "se"},
+        pool_entry{"Europe/Vienna",               "at"},
+        pool_entry{"Europe/Volgograd",            "ru"},
+        pool_entry{"Europe/Warsaw",               "pl"},
+        pool_entry{"Europe/Zurich",               "ch"},
+        pool_entry{"Indian/Mauritius",            "africa"},
+        pool_entry{"Indian/Reunion",              "africa"},
+        pool_entry{"Pacific/Auckland",            "nz"},
+        pool_entry{"Pacific/Chatham",             "nz"},
+        pool_entry{"Pacific/Easter",              "cl"},
+        pool_entry{"Pacific/Honolulu",            "us"},
+        };
+
+        static_assert(std::ranges::is_sorted(pool_table, {}, &pool_entry::name));
+
+
+        // Fallback for everything else, by the time zone's area.
+        constexpr std::array<pool_entry, 8> area_pools = {{
+            {"Africa/",    "africa"},
+            {"America/",   "north-america"},
+            {"Arctic/",    "europe"},
+            {"Asia/",      "asia"},
+            {"Australia/", "oceania"},
+            {"Europe/",    "europe"},
+            {"Indian/",    "asia"},
+            {"Pacific/",   "oceania"},
+        }};
+
+
+        constexpr std::chrono::sys_days wiiu_epoch = std::chrono::sys_days{
+            std::chrono::year{2000} / 1 / 1
+        };
+
+
+        // When the transition described by `r` happens in year `y`, as a UTC time point.
+        minutes
+        transition_time(const rule& r,
+                        std::chrono::year y,
+                        minutes offset_before)
+            noexcept
+        {
+            using namespace std::chrono;
+            const month m{r.month};
+            const weekday wd{r.weekday};
+            sys_days date;
+            if (r.week == 5)
+                date = sys_days{y / m / wd[last]};
+            else
+                date = sys_days{y / m / wd[r.week]};
+            return date - wiiu_epoch + minutes{r.time} - offset_before;
+        }
+
+
+        std::chrono::year
+        local_year(minutes t,
+                   minutes offset)
+            noexcept
+        {
+            using namespace std::chrono;
+            return year_month_day{floor<days>(wiiu_epoch + t + offset)}.year();
+        }
+
+    } // namespace
+
+
+    const zone*
+    find(std::string_view name)
+        noexcept
+    {
+        auto it = std::ranges::lower_bound(table, name, {}, &entry::name);
+        if (it == table.end() || it->name != name)
+            return nullptr;
+        return &it->rules;
+    }
+
+
+    std::optional<std::string_view>
+    pool_zone(std::string_view name)
+        noexcept
+    {
+        auto it = std::ranges::lower_bound(pool_table, name, {}, &pool_entry::name);
+        if (it != pool_table.end() && it->name == name)
+            return it->pool;
+
+        for (const auto& [area, pool] : area_pools)
+            if (name.starts_with(area))
+                return pool;
+
+        return {};
+    }
+
+
+    minutes
+    offset_at(const zone& z,
+              minutes t)
+        noexcept
+    {
+        const minutes std_offset{z.std_offset};
+        if (!z.has_dst())
+            return std_offset;
+
+        const minutes dst_offset{z.dst_offset};
+        const auto y = local_year(t, std_offset);
+        const minutes start = transition_time(z.dst_start, y, std_offset);
+        const minutes end   = transition_time(z.dst_end,   y, dst_offset);
+
+        bool dst;
+        if (start < end) // northern hemisphere
+            dst = start <= t && t < end;
+        else
+            dst = !(end <= t && t < start);
+
+        return dst ? dst_offset : std_offset;
+    }
+
+
+    std::optional<minutes>
+    next_transition(const zone& z,
+                    minutes t)
+        noexcept
+    {
+        if (!z.has_dst())
+            return {};
+
+        const minutes std_offset{z.std_offset};
+        const minutes dst_offset{z.dst_offset};
+        std::optional<minutes> result;
+        for (auto y = local_year(t, std_offset); !result; ++y)
+            for (auto candidate : {transition_time(z.dst_start, y, std_offset),
+                                   transition_time(z.dst_end,   y, dst_offset)})
+                if (candidate > t && (!result || candidate < *result))
+                    result = candidate;
+        return result;
+    }
+
+} // namespace tz
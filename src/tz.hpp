@@ -0,0 +1,80 @@
+/*
+ * Time Sync - A NTP client plugin for the Wii U.
+ *
+ * Copyright (C) 2025  Daniel K. O.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef TZ_HPP
+#define TZ_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+
+/*
+ * Compact time zone rules, compiled into the plugin.
+ *
+ * Each zone only stores its current rules (the POSIX TZ string from the IANA database),
+ * which are assumed to keep being used in the future. All time points are in minutes
+ * since 2000-01-01 00:00:00 UTC, like `utc::timestamp`.
+ */
+
+namespace tz {
+
+    // A "Mm.w.d/time" transition rule.
+    struct rule {
+        std::uint8_t month   = 0; // 1 - 12; 0 if there's no DST
+        std::uint8_t week    = 0; // 1 - 5; 5 means the last week
+        std::uint8_t weekday = 0; // 0 - 6; 0 is Sunday
+        std::int16_t time    = 0; // local minutes after midnight, may be negative or > 24h
+    };
+
+
+    struct zone {
+        std::int16_t std_offset = 0; // minutes east of UTC
+        std::int16_t dst_offset = 0;
+        rule         dst_start;      // given in standard time
+        rule         dst_end;        // given in daylight saving time
+
+        constexpr
+        bool
+        has_dst()
+            const noexcept
+        {
+            return dst_start.month != 0;
+        }
+    };
+
+
+    // Returns nullptr if the zone is not in the embedded table.
+    const zone*
+    find(std::string_view name)
+        noexcept;
+
+
+    // NTP pool zone (like "europe" or "br") closest to the zone; empty if unknown.
+    std::optional<std::string_view>
+    pool_zone(std::string_view name)
+        noexcept;
+
+
+    // UTC offset in effect at the time point `t`.
+    std::chrono::minutes
+    offset_at(const zone& z,
+              std::chrono::minutes t)
+        noexcept;
+
+
+    // The first offset change after `t`; empty if the zone has no DST.
+    std::optional<std::chrono::minutes>
+    next_transition(const zone& z,
+                    std::chrono::minutes t)
+        noexcept;
+
+} // namespace tz
+
+#endif
@@ -10,8 +10,6 @@
 
 #include "utc.hpp"
 
-#include "cfg.hpp"
-
 
 namespace utc {
 
@@ -25,10 +23,10 @@ namespace utc {
 
 
     timestamp
-    now()
+    now(std::chrono::minutes utc_offset)
         noexcept
     {
-        return timestamp{ local_time() - cfg::utc_offset.value };
+        return timestamp{ local_time() - utc_offset };
     }
 
 } // namespace utc
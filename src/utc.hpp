@@ -9,6 +9,8 @@
 #ifndef UTC_HPP
 #define UTC_HPP
 
+#include <chrono>
+
 #include "time_utils.hpp"
 
 
@@ -23,8 +25,9 @@ namespace utc {
     };
 
 
+    // Current UTC time, from the local clock and the time zone offset.
     timestamp
-    now()
+    now(std::chrono::minutes utc_offset)
         noexcept;
 
 } // namespace utc
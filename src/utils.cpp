@@ -6,14 +6,26 @@
  * SPDX-License-Identifier: MIT
  */
 
-#include <iterator>             // distance()
+#include <algorithm>            // ranges::stable_sort()
+#include <array>
+#include <charconv>             // from_chars()
+#include <condition_variable>
+#include <mutex>
+#include <numeric>              // iota()
+#include <optional>
 #include <stdexcept>            // logic_error, runtime_error
+#include <system_error>         // errc
+#include <thread>
+#include <utility>              // move()
 
 #include <nn/ac.h>
 
+#include <wupsxx/logger.hpp>
+
 #include "utils.hpp"
 
 #include "http_client.hpp"
+#include "trace.hpp"
 
 
 using namespace std::literals;
@@ -21,69 +33,227 @@ using namespace std::literals;
 using std::logic_error;
 using std::runtime_error;
 
+namespace logger = wups::logger;
+
 
 namespace utils {
 
-    std::vector<std::string>
-    split(const std::string& input,
-          const std::string& separators,
-          std::size_t max_tokens)
+    token_range::iterator::iterator(std::string_view input,
+                                    std::string_view separators)
+        noexcept :
+        input{input},
+        separators{separators},
+        start{input.find_first_not_of(separators)},
+        finish{input.find_first_of(separators, start)}
+    {}
+
+
+    std::string_view
+    token_range::iterator::operator *()
+        const noexcept
     {
-        using std::string;
+        return input.substr(start, finish - start);
+    }
+
 
-        std::vector<string> result;
+    token_range::iterator&
+    token_range::iterator::operator ++()
+        noexcept
+    {
+        start = input.find_first_not_of(separators, finish);
+        finish = input.find_first_of(separators, start);
+        return *this;
+    }
 
-        string::size_type start = input.find_first_not_of(separators);
-        while (start != string::npos) {
 
-            // if we can only include one more token
-            if (max_tokens && result.size() + 1 == max_tokens) {
-                // the last token will be the remaining of the input
-                result.push_back(input.substr(start));
-                break;
-            }
+    token_range::iterator
+    token_range::iterator::operator ++(int)
+        noexcept
+    {
+        auto old = *this;
+        ++*this;
+        return old;
+    }
 
-            auto finish = input.find_first_of(separators, start);
-            result.push_back(input.substr(start, finish - start));
-            start = input.find_first_not_of(separators, finish);
-        }
 
-        return result;
+    bool
+    token_range::iterator::operator ==(const iterator& other)
+        const noexcept
+    {
+        return start == other.start;
+    }
+
+
+    bool
+    token_range::iterator::operator ==(std::default_sentinel_t)
+        const noexcept
+    {
+        return start == std::string_view::npos;
+    }
+
+
+    token_range::token_range(std::string_view input,
+                             std::string_view separators)
+        noexcept :
+        input{input},
+        separators{separators}
+    {}
+
+
+    token_range::iterator
+    token_range::begin()
+        const noexcept
+    {
+        return iterator{input, separators};
+    }
+
+
+    std::default_sentinel_t
+    token_range::end()
+        const noexcept
+    {
+        return {};
+    }
+
+
+    counting_resource::counting_resource(std::pmr::memory_resource* upstream)
+        noexcept :
+        upstream{upstream}
+    {}
+
+
+    void*
+    counting_resource::do_allocate(std::size_t size,
+                                   std::size_t alignment)
+    {
+        void* ptr = upstream->allocate(size, alignment);
+        ++allocations;
+        bytes += size;
+        return ptr;
+    }
+
+
+    void
+    counting_resource::do_deallocate(void* ptr,
+                                     std::size_t size,
+                                     std::size_t alignment)
+    {
+        upstream->deallocate(ptr, size, alignment);
+    }
+
+
+    bool
+    counting_resource::do_is_equal(const std::pmr::memory_resource& other)
+        const noexcept
+    {
+        return this == &other;
     }
 
 
     namespace {
 
         /*
-         * Split CSV line:
-         *   - Separator is always `,`.
-         *   - Separators inside quotes (`"` or `'`) are ignored.
-         *   - Don't discard empty tokens.
+         * Incremental CSV parser, for input that arrives in chunks:
+         *   - Separator is always `,`, and rows end with `\n` (a `\r` before it is
+         *     dropped).
+         *   - Separators inside quotes (`"` or `'`) are ignored; the quotes are kept.
+         *   - Don't discard empty fields, but skip empty rows.
+         *
+         * Fields are views into the chunk, unless they span multiple chunks; then they
+         * are assembled in a small fixed buffer, and longer fields are an error.
          */
-        std::vector<std::string>
-        csv_split(const std::string& input)
-        {
-            using std::string;
-
-            std::vector<string> result;
-
-            string::size_type start = 0;
-            for (string::size_type i = 0; i < input.size(); ++i) {
-                char c = input[i];
-                if (c == '"' || c == '\'') {
-                    // jump to the closing quote
-                    i = input.find(c, i + 1);
-                    if (i == string::npos)
-                        break; // if there's no closing quote, it's bad input
-                } else if (c == ',') {
-                    result.push_back(input.substr(start, i - start));
-                    start = i + 1;
+        class csv_reader {
+
+            std::array<char, 128> pending;
+            std::size_t pending_size = 0;
+            char quote = 0;     // the open quote, if inside quotes
+            unsigned row = 0;
+            unsigned col = 0;
+
+
+            void
+            append_pending(std::string_view part)
+            {
+                if (part.size() > pending.size() - pending_size)
+                    throw runtime_error{"CSV field is too long."};
+                part.copy(pending.data() + pending_size, part.size());
+                pending_size += part.size();
+            }
+
+
+            template<typename F>
+            bool
+            emit(std::string_view part,
+                 F& on_field)
+            {
+                std::string_view field = part;
+                if (pending_size) {
+                    append_pending(part);
+                    field = {pending.data(), pending_size};
+                    pending_size = 0;
                 }
+                if (field.ends_with('\r'))
+                    field.remove_suffix(1);
+                return on_field(row, col, field);
             }
-            // whatever remains from `start` to the end is the last token
-            result.push_back(input.substr(start));
-            return result;
-        }
+
+        public:
+
+            /*
+             * Calls `on_field(row, col, field)` for every complete field in `chunk`.
+             * Returns false as soon as `on_field` returns false.
+             */
+            template<typename F>
+            bool
+            feed(std::string_view chunk,
+                 F&& on_field)
+            {
+                std::string_view::size_type start = 0;
+                for (std::string_view::size_type i = 0; i < chunk.size(); ++i) {
+                    char c = chunk[i];
+                    if (quote) {
+                        if (c == quote)
+                            quote = 0;
+                    } else if (c == '"' || c == '\'') {
+                        quote = c;
+                    } else if (c == ',') {
+                        if (!emit(chunk.substr(start, i - start), on_field))
+                            return false;
+                        ++col;
+                        start = i + 1;
+                    } else if (c == '\n') {
+                        auto part = chunk.substr(start, i - start);
+                        bool empty_row = col == 0 && !pending_size
+                            && (part.empty() || part == "\r");
+                        if (!empty_row) {
+                            if (!emit(part, on_field))
+                                return false;
+                            ++row;
+                        }
+                        col = 0;
+                        start = i + 1;
+                    }
+                }
+                append_pending(chunk.substr(start));
+                return true;
+            }
+
+
+            // Emits the last field, if the input didn't end with a newline.
+            template<typename F>
+            bool
+            finish(F&& on_field)
+            {
+                if (col == 0 && !pending_size)
+                    return true;
+                if (!emit({}, on_field))
+                    return false;
+                ++row;
+                col = 0;
+                return true;
+            }
+
+        };
 
     } // namespace
 
@@ -106,129 +276,478 @@ namespace utils {
 
 
     namespace {
-        constexpr int num_tz_services = 3;
-    }
+
+        using tz_info = std::pair<std::string, std::chrono::minutes>;
+
+
+        enum class offset_format {
+            seconds,            // "3600"
+            hhmm,               // "+0100"
+        };
+
+
+        struct tz_provider {
+            const char* name;
+            const char* url;
+            // When not null, the first CSV row holds these keys; otherwise the fields
+            // are in this order: name, offset.
+            const char* name_key;
+            const char* offset_key;
+            offset_format format;
+        };
+
+
+        const std::array tz_providers = {
+            tz_provider{
+                "http://ip-api.com",
+                "http://ip-api.com/csv/?fields=timezone,offset",
+                nullptr,
+                nullptr,
+                offset_format::seconds
+            },
+            tz_provider{
+                "https://ipwho.is",
+                "https://ipwho.is/?fields=timezone.id,timezone.offset&output=csv",
+                nullptr,
+                nullptr,
+                offset_format::seconds
+            },
+            tz_provider{
+                "https://ipapi.co",
+                "https://ipapi.co/csv",
+                "timezone",
+                "utc_offset",
+                offset_format::hhmm
+            },
+        };
+
+
+        template<typename T>
+        std::optional<T>
+        parse_number(std::string_view str)
+        {
+            T value{};
+            auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+            if (ec != std::errc{} || ptr != str.data() + str.size())
+                return {};
+            return value;
+        }
+
+
+        std::optional<std::chrono::minutes>
+        parse_offset(std::string_view str,
+                     offset_format format)
+        {
+            switch (format) {
+            case offset_format::seconds:
+                if (auto secs = parse_number<int>(str))
+                    return duration_cast<std::chrono::minutes>(std::chrono::seconds{*secs});
+                return {};
+            case offset_format::hhmm:
+                {
+                    if (str.size() != 5 || (str[0] != '+' && str[0] != '-'))
+                        return {};
+                    auto h = parse_number<int>(str.substr(1, 2));
+                    auto m = parse_number<int>(str.substr(3, 2));
+                    if (!h || !m)
+                        return {};
+                    std::chrono::minutes total{*h * 60 + *m};
+                    return str[0] == '-' ? -total : total;
+                }
+            }
+            return {};
+        }
+
+
+        /*
+         * Extracts the time zone from a response as it arrives, keeping only the two
+         * fields needed.
+         */
+        class tz_parser {
+
+            const tz_provider& provider;
+            csv_reader csv;
+            int name_col = 0;
+            int offset_col = 1;
+            unsigned values_row = 0;
+
+            std::optional<std::string> name;
+            std::optional<std::chrono::minutes> offset;
+
+
+            bool
+            on_field(unsigned row,
+                     unsigned col,
+                     std::string_view field)
+            {
+                if (row < values_row) {
+                    // header row
+                    if (field == provider.name_key)
+                        name_col = col;
+                    if (field == provider.offset_key)
+                        offset_col = col;
+                    return true;
+                }
+
+                if (row > values_row)
+                    return false;
+
+                if (static_cast<int>(col) == name_col)
+                    name.emplace(field);
+                if (static_cast<int>(col) == offset_col) {
+                    offset = parse_offset(field, provider.format);
+                    if (!offset)
+                        throw runtime_error{"Invalid UTC offset from "s + provider.name};
+                }
+                // Stop reading once we have both.
+                return !(name && offset);
+            }
+
+        public:
+
+            tz_parser(const tz_provider& p) :
+                provider(p)
+            {
+                if (provider.name_key) {
+                    name_col = offset_col = -1;
+                    values_row = 1;
+                }
+            }
+
+
+            // Returns false when no more input is needed.
+            bool
+            feed(std::string_view chunk)
+            {
+                return csv.feed(chunk,
+                                [this](unsigned row, unsigned col, std::string_view field)
+                                {
+                                    return on_field(row, col, field);
+                                });
+            }
+
+
+            tz_info
+            finish()
+            {
+                if (!name || !offset)
+                    csv.finish([this](unsigned row, unsigned col, std::string_view field)
+                               {
+                                   return on_field(row, col, field);
+                               });
+                if (!name || !offset)
+                    throw runtime_error{"Could not parse response from "s + provider.name};
+                return {std::move(*name), *offset};
+            }
+
+        };
+
+
+        // The last choice is to race all providers.
+        const int fastest_tz_service = tz_providers.size();
+
+
+        constexpr std::chrono::milliseconds tz_race_timeout = 15s;
+
+
+        /*
+         * Moving average of each provider's latency, in milliseconds. Races start the
+         * fastest providers first. A failure is charged the full race timeout, so a
+         * provider that fails fast doesn't look fast.
+         */
+        std::mutex tz_latency_mutex;
+        std::array<double, tz_providers.size()> tz_latency{};
+
+
+        void
+        update_tz_latency(std::size_t idx,
+                          std::chrono::milliseconds elapsed)
+        {
+            std::lock_guard lock{tz_latency_mutex};
+            if (tz_latency[idx] == 0)
+                tz_latency[idx] = elapsed.count();
+            else
+                tz_latency[idx] = 0.75 * tz_latency[idx] + 0.25 * elapsed.count();
+        }
+
+
+        std::array<std::size_t, tz_providers.size()>
+        get_tz_ranking()
+        {
+            std::array<std::size_t, tz_providers.size()> order;
+            std::iota(order.begin(), order.end(), 0);
+            std::lock_guard lock{tz_latency_mutex};
+            std::ranges::stable_sort(order,
+                                     [](std::size_t a, std::size_t b)
+                                     {
+                                         return tz_latency[a] < tz_latency[b];
+                                     });
+            return order;
+        }
+
+
+        tz_info
+        race_timezone(std::stop_token token)
+        {
+            auto order = get_tz_ranking();
+
+            std::vector<std::string> urls;
+            std::vector<tz_parser> parsers;
+            for (auto idx : order) {
+                urls.push_back(tz_providers[idx].url);
+                parsers.emplace_back(tz_providers[idx]);
+            }
+
+            std::optional<tz_info> info;
+            auto result = http::race(urls,
+                                     [&parsers](std::size_t i, std::string_view chunk)
+                                     {
+                                         return parsers[i].feed(chunk);
+                                     },
+                                     [&](std::size_t i)
+                                     {
+                                         try {
+                                             info = parsers[i].finish();
+                                             return true;
+                                         }
+                                         catch (std::exception&) {
+                                             return false;
+                                         }
+                                     },
+                                     token,
+                                     tz_race_timeout);
+
+            for (std::size_t i = 0; i < order.size(); ++i)
+                update_tz_latency(order[i],
+                                  result.failed[i] ? tz_race_timeout : result.elapsed[i]);
+
+            if (!result.winner || !info)
+                throw runtime_error{"No time zone service gave a valid answer."};
+
+            return *info;
+        }
+
+    } // namespace
 
 
     int
     get_num_tz_services()
     {
-        return num_tz_services;
+        return tz_providers.size() + 1;
     }
 
 
     const char*
     get_tz_service_name(int idx)
     {
-        switch (idx) {
-        case 0:
-            return "http://ip-api.com";
-        case 1:
-            return "https://ipwho.is";
-        case 2:
-            return "https://ipapi.co";
-        default:
+        if (idx == fastest_tz_service)
+            return "fastest service";
+        if (idx < 0 || idx > fastest_tz_service)
             throw logic_error{"Invalid tz service."};
-        }
+        return tz_providers[idx].name;
     }
 
 
     std::pair<std::string, std::chrono::minutes>
-    fetch_timezone(int idx)
+    fetch_timezone(int idx,
+                   std::stop_token token)
     {
-        const char* service = get_tz_service_name(idx);
+        trace::span span{"tz fetch"};
 
-        static const char* urls[num_tz_services] = {
-            "http://ip-api.com/csv/?fields=timezone,offset",
-            "https://ipwho.is/?fields=timezone.id,timezone.offset&output=csv",
-            "https://ipapi.co/csv"
-        };
+        if (idx == fastest_tz_service)
+            return race_timezone(token);
+
+        if (idx < 0 || idx > fastest_tz_service)
+            throw logic_error{"Invalid tz service."};
+
+        tz_parser parser{tz_providers[idx]};
+        http::get(tz_providers[idx].url,
+                  [&parser](std::string_view chunk)
+                  {
+                      return parser.feed(chunk);
+                  },
+                  token);
+        return parser.finish();
+    }
+
+
+    namespace {
 
-        network_guard net_guard;
+        /*
+         * Keeps the nn::ac session open while there are leases.
+         *
+         * The mutex is never held while connecting, since that can block for a long
+         * time; `connecting` makes other callers wait on the condition variable instead.
+         */
+        class connection_manager {
 
-        std::string response = http::get(urls[idx]);
+            std::mutex mutex;
+            std::condition_variable_any cv;
+            unsigned leases = 0;
+            bool connected = false;
+            bool connecting = false;
+            std::jthread closer;
 
-        switch (idx) {
-        case 0: // http://ip-api.com
-        case 1: // https://ipwho.is
+            static constexpr std::chrono::seconds grace_period{30};
+
+
+            void
+            disconnect()
+                noexcept
             {
-                auto tokens = csv_split(response);
-                if (size(tokens) != 2)
-                    throw runtime_error{"Could not parse response from "s + service};
-                std::string name = tokens[0];
-                auto offset = std::chrono::seconds{std::stoi(tokens[1])};
-                return {name, duration_cast<std::chrono::minutes>(offset)};
+                nn::ac::Close();
+                nn::ac::Finalize();
+                connected = false;
             }
 
-        case 2: // https://ipapi.co
+
+            void
+            close_idle(std::stop_token token)
             {
-                // This returns a CSV header and CSV fields in two rows, gotta find
-                // indexes for "timezone" and "utc_offset" fields. The "utc_offset" is
-                // returned as +HHMM, not seconds.
-                auto lines = split(response, "\r\n");
-                if (size(lines) != 2)
-                    throw runtime_error{"Could not parse response from "s + service};
-
-                auto keys = csv_split(lines[0]);
-                auto values = csv_split(lines[1]);
-                if (size(keys) != size(values))
-                    throw runtime_error{"Incoherent response from "s + service};
-
-                auto tz_it = std::ranges::find(keys, "timezone");
-                auto offset_it = std::ranges::find(keys, "utc_offset");
-                if (tz_it == keys.end() || offset_it == keys.end())
-                    throw runtime_error{"Could not find timezone or utc_offset fields"
-                                        " in response."};
-
-                auto tz_idx = std::distance(keys.begin(), tz_it);;
-                auto offset_idx = std::distance(keys.begin(), offset_it);
-
-                std::string name = values[tz_idx];
-                std::string hhmm = values[offset_idx];
-                if (empty(hhmm))
-                    throw runtime_error{"Invalid UTC offset string."};
-
-                char sign = hhmm[0];
-                std::string hh = hhmm.substr(1, 2);
-                std::string mm = hhmm.substr(3, 2);
-                int h = std::stoi(hh);
-                int m = std::stoi(mm);
-                int total = h * 60 + m;
-                if (sign == '-')
-                    total = -total;
-                return {name, std::chrono::minutes{total}};
-            }
-
-        default:
-            throw logic_error{"Invalid tz service."};
-        }
+                std::unique_lock lock{mutex};
+                while (cv.wait(lock, token, [this] { return connected && !leases; })) {
+                    if (cv.wait_for(lock, token, grace_period, [this] { return leases > 0; }))
+                        continue;
+                    if (token.stop_requested())
+                        break;
+                    disconnect();
+                }
+            }
 
-    }
+        public:
+
+            // Reuses the open session if there is one, instead of initializing nn::ac again.
+            std::optional<std::uint32_t>
+            address()
+                noexcept
+            {
+                std::lock_guard lock{mutex};
+                if (!connected && !nn::ac::Initialize())
+                    return {};
+
+                std::optional<std::uint32_t> result;
+                ACConnectStatus status = AC_STATUS_FAILED;
+                std::uint32_t address = 0;
+                if (nn::ac::GetConnectStatus(&status)
+                    && status == AC_STATUS_OK
+                    && nn::ac::GetAssignedAddress(&address))
+                    result = address;
+
+                if (!connected)
+                    nn::ac::Finalize();
+                return result;
+            }
+
+
+            void
+            acquire()
+            {
+                std::unique_lock lock{mutex};
+                cv.wait(lock, [this] { return !connecting; });
+                if (!connected) {
+                    connecting = true;
+                    lock.unlock();
+
+                    const char* failure = nullptr;
+                    {
+                        trace::span span{"network connect"};
+                        if (!nn::ac::Initialize())
+                            failure = "Network error (nn::ac::Initialize() failed)";
+                        else if (!nn::ac::Connect()) {
+                            nn::ac::Finalize();
+                            failure = "Network error (nn::ac::Connect() failed)";
+                        }
+                    }
+
+                    lock.lock();
+                    connecting = false;
+                    cv.notify_all();
+                    if (failure)
+                        throw runtime_error{failure};
+                    connected = true;
+                }
+                ++leases;
+                cv.notify_all();
+            }
+
+
+            void
+            release()
+                noexcept
+            {
+                std::lock_guard lock{mutex};
+                if (--leases)
+                    return;
+                if (!closer.joinable()) {
+                    try {
+                        closer = std::jthread{[this](std::stop_token token)
+                                              {
+                                                  close_idle(token);
+                                              }};
+                    }
+                    catch (std::exception& e) {
+                        // Without the closer, there's no grace period: close it now.
+                        logger::printf("Failed to start network closer thread: %s\n",
+                                       e.what());
+                        disconnect();
+                        return;
+                    }
+                }
+                cv.notify_all();
+            }
+
+
+            void
+            close()
+                noexcept
+            {
+                std::jthread old_closer;
+                {
+                    std::lock_guard lock{mutex};
+                    old_closer = std::move(closer);
+                }
+                // Stop and join the closer thread without holding the lock.
+                old_closer = {};
+
+                std::lock_guard lock{mutex};
+                if (connected && !leases)
+                    disconnect();
+            }
+
+        };
+
+
+        connection_manager connection;
+
+    } // namespace
 
 
-    network_guard::init_guard::init_guard()
+    std::optional<std::uint32_t>
+    get_network_address()
+        noexcept
     {
-        if (!nn::ac::Initialize())
-            throw runtime_error{"Network error (nn::ac::Initialize() failed)"};
+        return connection.address();
     }
 
 
-    network_guard::init_guard::~init_guard()
+    network_guard::network_guard()
     {
-        nn::ac::Finalize();
+        connection.acquire();
     }
 
 
-    network_guard::connect_guard::connect_guard()
+    network_guard::~network_guard()
+        noexcept
     {
-        if (!nn::ac::Connect())
-            throw runtime_error{"Network error (nn::ac::Connect() failed)"};
+        connection.release();
     }
 
 
-    network_guard::connect_guard::~connect_guard()
+    void
+    close_network()
+        noexcept
     {
-        nn::ac::Close();
+        connection.close();
     }
 
 } // namespace utils
@@ -11,24 +11,110 @@
 
 #include <atomic>
 #include <chrono>
-#include <cstddef>              // size_t
+#include <cstddef>              // size_t, ptrdiff_t
+#include <cstdint>
+#include <iterator>             // default_sentinel_t, forward_iterator_tag
+#include <memory_resource>
+#include <optional>
+#include <stop_token>
 #include <string>
+#include <string_view>
 #include <utility>              // pair<>
-#include <vector>
 
 
 namespace utils {
 
     /**
-     * Split input string into tokens, according to separators.
+     * Lazy range of tokens from the input string, according to separators.
      *
-     * If max_tokens is not zero, only up to max_tokens will be generated; the last token
-     * will be the remaining of the string.
+     * Tokens are views into the input, so this never allocates; the input must outlive
+     * the range.
      */
-    std::vector<std::string>
-    split(const std::string& input,
-          const std::string& separators,
-          std::size_t max_tokens = 0);
+    class token_range {
+
+        std::string_view input;
+        std::string_view separators;
+
+    public:
+
+        class iterator {
+
+            std::string_view input;
+            std::string_view separators;
+            std::string_view::size_type start  = std::string_view::npos;
+            std::string_view::size_type finish = std::string_view::npos;
+
+        public:
+
+            using value_type        = std::string_view;
+            using difference_type   = std::ptrdiff_t;
+            using iterator_category = std::forward_iterator_tag;
+
+
+            constexpr
+            iterator() noexcept = default;
+
+            iterator(std::string_view input,
+                     std::string_view separators)
+                noexcept;
+
+
+            std::string_view operator *() const noexcept;
+
+            iterator& operator ++() noexcept;
+            iterator  operator ++(int) noexcept;
+
+            bool operator ==(const iterator& other) const noexcept;
+            bool operator ==(std::default_sentinel_t) const noexcept;
+
+        };
+
+
+        token_range(std::string_view input,
+                    std::string_view separators)
+            noexcept;
+
+
+        iterator begin() const noexcept;
+
+        std::default_sentinel_t end() const noexcept;
+
+    };
+
+
+    // Memory resource that counts how many allocations pass through it.
+    class counting_resource : public std::pmr::memory_resource {
+
+        std::pmr::memory_resource* upstream;
+
+    public:
+
+        std::size_t allocations = 0;
+        std::size_t bytes = 0;
+
+
+        counting_resource(std::pmr::memory_resource* upstream
+                          = std::pmr::get_default_resource())
+            noexcept;
+
+    private:
+
+        void*
+        do_allocate(std::size_t size,
+                    std::size_t alignment)
+            override;
+
+        void
+        do_deallocate(void* ptr,
+                      std::size_t size,
+                      std::size_t alignment)
+            override;
+
+        bool
+        do_is_equal(const std::pmr::memory_resource& other)
+            const noexcept override;
+
+    };
 
 
     // RAII type to ensure a function is never executed in parallel.
@@ -52,30 +138,44 @@ namespace utils {
     get_tz_service_name(int idx);
 
 
+    // The caller must hold a `network_guard`.
     std::pair<std::string,
               std::chrono::minutes>
-    fetch_timezone(int idx);
+    fetch_timezone(int idx,
+                   std::stop_token token = {});
+
 
+    // The console's address, if the network is connected; never tries to connect.
+    std::optional<std::uint32_t>
+    get_network_address()
+        noexcept;
 
-    // RAII class to ensure network is working.
-    // It blocks until the network is available, of throws std::runtime_error.
+
+    /*
+     * RAII lease on the shared network connection.
+     *
+     * The `nn::ac` session is opened by the first lease, and stays open while any lease
+     * exists, plus a short grace period after the last one is gone; so back-to-back
+     * operations don't reconnect. Throws std::runtime_error if the network is unavailable.
+     */
     class network_guard {
 
-        struct init_guard {
-            init_guard();
-            ~init_guard();
-        };
+    public:
 
-        struct connect_guard {
-            connect_guard();
-            ~connect_guard();
-        };
+        network_guard();
+        ~network_guard()
+            noexcept;
 
-        init_guard init;
-        connect_guard conn;
+        network_guard(const network_guard&) = delete;
 
     };
 
+
+    // Closes the shared connection right away, if no lease is held.
+    void
+    close_network()
+        noexcept;
+
 } // namespace utils
 
 #endif